@@ -20,4 +20,6 @@
 #define DEFMWFACT		0.6	/* master width factor [0.1 .. 0.9] */
 #define DEFNMASTER		1	/* number of windows in master area */
 #define SNAP			5	/* snap pixel */
+#define REFRESH			60	/* refresh rate (Hz) if RandR can't tell */
+#define SYNCTIMEOUT		100	/* ms to wait for a _NET_WM_SYNC_REQUEST */
 #define DECORATETILED		0	/* set to 1 to draw titles in tiled layouts */
@@ -13,8 +13,8 @@ DOCPREFIX?= ${PREFIX}/share/doc
 CONF?= ${CONFPREFIX}
 
 # includes and libs
-CFLAGS += -I. `pkg-config --cflags x11 xft`
-LIBS += `pkg-config --libs x11 xft`
+CFLAGS += -I. `pkg-config --cflags x11 xft fontconfig`
+LIBS += `pkg-config --libs x11 xft fontconfig`
 CPPFLAGS += -DVERSION=\"${VERSION}\" -DSYSCONFPATH=\"${CONF}\"
 
 # debug flags
@@ -36,6 +36,13 @@ LIBS += $(shell pkg-config --libs xrandr)
 CFLAGS += $(shell pkg-config --cflags xrandr)
 endif
 
+# XSync (_NET_WM_SYNC_REQUEST support). Comment out to disable.
+ifdef SYNCREQUEST
+CPPFLAGS += -DXSYNC=1
+LIBS += $(shell pkg-config --libs xext)
+CFLAGS += $(shell pkg-config --cflags xext)
+endif
+
 # Solaris
 #CFLAGS = -fast ${INCS} -DVERSION=\"${VERSION}\"
 #LDFLAGS = ${LIBS}
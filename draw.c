@@ -2,9 +2,11 @@
  *  echinus wm written by Alexander Polakov <polachok@gmail.com>
  *  this file contains code related to drawing
  */
+#define _POSIX_C_SOURCE 200809L
 #include <regex.h>
 #include <ctype.h>
 #include <assert.h>
+#include <time.h>
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
 #include <X11/Xproto.h>
@@ -18,6 +20,24 @@ enum { AlignLeft, AlignCenter, AlignRight };	/* title position */
 
 static unsigned int textnw(const char *text, unsigned int len);
 static unsigned int textw(const char *text);
+static int glyphw(FcChar32 ch);
+
+#define GLYPHTAB	512
+typedef struct {
+	FcChar32 ch;		/* GLYPHNONE when empty */
+	int w;
+} Advance;		/* cached advance of one character */
+#define GLYPHNONE	((FcChar32) -1)
+
+/* titlelayout compiled by inittitle(): left elements in order, centered
+ * ones in order, then right aligned ones from the right edge inwards */
+typedef struct {
+	char which;		/* element, see titlelayout */
+	int align;
+} TitleOp;
+
+static TitleOp titleops[LENGTH(style.titlelayout)];
+static int ntitleops;
 
 typedef struct {
 	unsigned int x, y, w, h;
@@ -29,6 +49,8 @@ typedef struct {
 		int width;
 	} font;
 	GC gc;
+	Window outline[4];	/* the sides of the wireframe */
+	Advance glyphs[GLYPHTAB];
 } DC;				/* draw context */
 
 DC dc;
@@ -36,35 +58,51 @@ DC dc;
 static int
 drawtext(const char *text, Drawable drawable, XftDraw *xftdrawable,
     unsigned long col[ColLast], int x, int y, int mw) {
-	int w, h;
+	int w, h, dots, lo, hi, mid, l;
 	char buf[256];
-	unsigned int len, olen;
+	/* sums[i] is the width of the first i characters, ends[i] their length */
+	int sums[sizeof buf];
+	unsigned int ends[sizeof buf];
+	unsigned int len, n;
+	FcChar32 ch;
 
 	if (!text)
 		return 0;
-	olen = len = strlen(text);
-	w = 0;
-	if (len >= sizeof buf)
-		len = sizeof buf - 1;
+	len = strlen(text);
+	if (len >= sizeof buf - 3)
+		len = sizeof buf - 4;
 	memcpy(buf, text, len);
-	buf[len] = 0;
 	h = style.titleheight;
 	y = dc.h / 2 + dc.font.ascent / 2 - 1 - style.outline;
 	x += dc.font.height / 2;
-	/* shorten text if necessary */
-	while (len && (w = textnw(buf, len)) > mw) {
-		buf[--len] = 0;
+	/* one pass over the text, an incomplete character at the end of a
+	 * clipped title stops it like it stops Xft */
+	sums[0] = ends[0] = n = 0;
+	while (ends[n] < len
+	    && (l = FcUtf8ToUcs4((FcChar8 *) buf + ends[n], &ch, len - ends[n])) > 0) {
+		sums[n + 1] = sums[n] + glyphw(ch);
+		ends[n + 1] = ends[n] + l;
+		n++;
 	}
-	if (len < olen) {
-		if (len > 1)
-			buf[len - 1] = '.';
-		if (len > 2)
-			buf[len - 2] = '.';
-		if (len > 3)
-			buf[len - 3] = '.';
+	len = ends[n];
+	w = sums[n];
+	if (w > mw || len < strlen(text)) {
+		/* shorten text: the most characters that fit with the dots */
+		dots = 3 * glyphw('.');
+		if (dots > mw)
+			return 0;	/* too long */
+		for (lo = 0, hi = n; lo < hi;) {
+			mid = (lo + hi + 1) / 2;
+			if (sums[mid] + dots <= mw)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+		len = ends[lo];
+		memcpy(buf + len, "...", 3);
+		len += 3;
+		w = sums[lo] + dots;
 	}
-	if (w > mw)
-		return 0;	/* too long */
 	while (x <= 0)
 		x = dc.x++;
 	XSetForeground(dpy, dc.gc, col[ColBG]);
@@ -99,33 +137,33 @@ drawelement(char which, int x, int position, Client *c) {
 	case 'T':
 		w = 0;
 		for (j = 0; j < ntags; j++) {
-			if (c->tags[j])
-				w += drawtext(tags[j], c->drawable, c->xftdraw,
+			if (ISTAGGED(c->tags, j))
+				w += drawtext(tags[j], c->cold->drawable, c->cold->xftdraw,
 				    color, dc.x, dc.y, dc.w);
 		}
 		break;
 	case '|':
 		XSetForeground(dpy, dc.gc, color[ColBorder]);
-		XDrawLine(dpy, c->drawable, dc.gc, dc.x + dc.h / 4, 0,
+		XDrawLine(dpy, c->cold->drawable, dc.gc, dc.x + dc.h / 4, 0,
 		    dc.x + dc.h / 4, dc.h);
 		w = dc.h / 2;
 		break;
 	case 'N':
-		w = drawtext(c->name, c->drawable, c->xftdraw, color, dc.x, dc.y, dc.w);
+		w = drawtext(c->cold->name, c->cold->drawable, c->cold->xftdraw, color, dc.x, dc.y, dc.w);
 		break;
 	case 'I':
 		button[Iconify].x = dc.x;
-		w = drawbutton(c->drawable, button[Iconify], color,
+		w = drawbutton(c->cold->drawable, button[Iconify], color,
 		    dc.x, dc.h / 2 - button[Iconify].ph / 2);
 		break;
 	case 'M':
 		button[Maximize].x = dc.x;
-		w = drawbutton(c->drawable, button[Maximize], color,
+		w = drawbutton(c->cold->drawable, button[Maximize], color,
 		    dc.x, dc.h / 2 - button[Maximize].ph / 2);
 		break;
 	case 'C':
 		button[Close].x = dc.x;
-		w = drawbutton(c->drawable, button[Close], color, dc.x,
+		w = drawbutton(c->cold->drawable, button[Close], color, dc.x,
 		    dc.h / 2 - button[Maximize].ph / 2);
 		break;
 	default:
@@ -135,8 +173,9 @@ drawelement(char which, int x, int position, Client *c) {
 	return w;
 }
 
+/* namew is textw(c->cold->name), measured once per title */
 static int
-elementw(char which, Client *c) {
+elementw(char which, Client *c, int namew) {
 	int w;
 	unsigned int j;
 
@@ -146,11 +185,11 @@ elementw(char which, Client *c) {
 	case 'C':
 		return dc.h;
 	case 'N':
-		return textw(c->name);
+		return namew;
 	case 'T':
 		w = 0;
 		for (j = 0; j < ntags; j++) {
-			if (c->tags[j])
+			if (ISTAGGED(c->tags, j))
 				w += textw(tags[j]);
 		}
 		return w;
@@ -160,67 +199,205 @@ elementw(char which, Client *c) {
 	return 0;
 }
 
-void
-drawclient(Client *c) {
-	size_t i;
+static void
+drawtitle(Client *c) {
+	TitleOp *op;
+	int align, namew;
 
-	if (style.opacity) {
-		setopacity(c, c == sel ? OPAQUE : style.opacity);
-	}
-	if (!isvisible(c, NULL))
-		return;
-	if (!c->title)
-		return;
 	dc.x = dc.y = 0;
 	dc.w = c->w;
 	dc.h = style.titleheight;
-	XftDrawChange(c->xftdraw, c->drawable);
+	XftDrawChange(c->cold->xftdraw, c->cold->drawable);
 	XSetForeground(dpy, dc.gc, c == sel ? style.color.sel[ColBG] : style.color.norm[ColBG]);
 	XSetLineAttributes(dpy, dc.gc, style.border, LineSolid, CapNotLast, JoinMiter);
-	XFillRectangle(dpy, c->drawable, dc.gc, dc.x, dc.y, dc.w, dc.h);
-	if (dc.w < textw(c->name)) {
+	XFillRectangle(dpy, c->cold->drawable, dc.gc, dc.x, dc.y, dc.w, dc.h);
+	namew = textw(c->cold->name);
+	if (dc.w < namew) {
 		dc.w -= dc.h;
 		button[Close].x = dc.w;
-		drawtext(c->name, c->drawable, c->xftdraw,
+		drawtext(c->cold->name, c->cold->drawable, c->cold->xftdraw,
 		    c == sel ? style.color.sel : style.color.norm, dc.x, dc.y, dc.w);
-		drawbutton(c->drawable, button[Close],
+		drawbutton(c->cold->drawable, button[Close],
 		    c == sel ? style.color.sel : style.color.norm, dc.w,
 		    dc.h / 2 - button[Close].ph / 2);
 		goto end;
 	}
-	/* Left */
-	for (i = 0; i < strlen(style.titlelayout); i++) {
-		if (style.titlelayout[i] == ' ' || style.titlelayout[i] == '-')
+	align = AlignLeft;
+	for (op = titleops; op < titleops + ntitleops; op++) {
+		if (op->align != align) {
+			if (dc.x >= dc.w)
+				break;
+			align = op->align;
+			dc.x = align == AlignCenter ? dc.w / 2 : dc.w;
+		}
+		switch (align) {
+		case AlignLeft:
+			dc.x += drawelement(op->which, dc.x, align, c);
 			break;
-		dc.x += drawelement(style.titlelayout[i], dc.x, AlignLeft, c);
-	}
-	if (i == strlen(style.titlelayout) || dc.x >= dc.w)
-		goto end;
-	/* Center */
-	dc.x = dc.w / 2;
-	for (i++; i < strlen(style.titlelayout); i++) {
-		if (style.titlelayout[i] == ' ' || style.titlelayout[i] == '-')
+		case AlignCenter:
+			dc.x -= elementw(op->which, c, namew) / 2;
+			dc.x += drawelement(op->which, 0, align, c);
 			break;
-		dc.x -= elementw(style.titlelayout[i], c) / 2;
-		dc.x += drawelement(style.titlelayout[i], 0, AlignCenter, c);
-	}
-	if (i == strlen(style.titlelayout) || dc.x >= dc.w)
-		goto end;
-	/* Right */
-	dc.x = dc.w;
-	for (i = strlen(style.titlelayout); i-- ; ) {
-		if (style.titlelayout[i] == ' ' || style.titlelayout[i] == '-')
+		case AlignRight:
+			dc.x -= elementw(op->which, c, namew);
+			drawelement(op->which, 0, align, c);
 			break;
-		dc.x -= elementw(style.titlelayout[i], c);
-		drawelement(style.titlelayout[i], 0, AlignRight, c);
+		}
 	}
       end:
 	if (style.outline) {
 		XSetForeground(dpy, dc.gc,
 		    c == sel ? style.color.sel[ColBorder] : style.color.norm[ColBorder]);
-		XDrawLine(dpy, c->drawable, dc.gc, 0, dc.h - 1, dc.w, dc.h - 1);
+		XDrawLine(dpy, c->cold->drawable, dc.gc, 0, dc.h - 1, dc.w, dc.h - 1);
+	}
+}
+
+#ifdef DEBUG
+/* what titles cost, printed once a second */
+static void
+drawstats(struct timespec *t0, Bool copied) {
+	static unsigned long drawn, copies;
+	static long since, us;
+	struct timespec t1;
+	long now;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	us += (t1.tv_sec - t0->tv_sec) * 1000000 + (t1.tv_nsec - t0->tv_nsec) / 1000;
+	if (copied)
+		copies++;
+	else
+		drawn++;
+	if ((now = msnow()) - since >= 1000) {
+		DPRINTF("%lu titles drawn, %lu copied in %ld us, %ld us per title\n",
+		    drawn, copies, us, us / (long) (drawn + copies));
+		drawn = copies = 0;
+		us = 0;
+		since = now;
 	}
-	XCopyArea(dpy, c->drawable, c->title, dc.gc, 0, 0, c->w, dc.h, 0, 0);
+}
+#endif
+
+/* Titles are kept rendered per client in both colors, so refocusing is
+ * a copy.  A render is reused while the name, tags and width it was
+ * drawn for still hold and no button is held down. */
+void
+drawclient(Client *c) {
+	TitleCache *t;
+	Bool pressed = False;
+	int i;
+#ifdef DEBUG
+	struct timespec t0;
+#endif
+
+	if (style.opacity) {
+		setopacity(c, c == sel ? OPAQUE : style.opacity);
+	}
+	if (!isvisible(c, NULL))
+		return;
+	/* maximized or undecorated: no title to draw, and a zero high
+	 * pixmap is a BadValue */
+	if (!c->title || !c->th)
+		return;
+#ifdef DEBUG
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+#endif
+	for (i = 0; i < LastBtn; i++)
+		if (button[i].pressed)
+			pressed = True;
+	t = &c->cold->titles[c == sel ? Selected : Normal];
+	if (!pressed && t->pm && t->w == c->w && !strcmp(t->name, c->cold->name)
+	    && !memcmp(&t->tags, c->tags, sizeof(Tags))) {
+		for (i = 0; i < LastBtn; i++)
+			button[i].x = t->bx[i];
+		XCopyArea(dpy, t->pm, c->title, dc.gc, 0, 0, c->w, c->th, 0, 0);
+#ifdef DEBUG
+		drawstats(&t0, True);
+#endif
+		return;
+	}
+	drawtitle(c);
+	if (!pressed) {
+		if (t->pm && t->w != c->w) {
+			XFreePixmap(dpy, t->pm);
+			t->pm = None;
+		}
+		if (!t->pm)
+			t->pm = XCreatePixmap(dpy, root, c->w, c->th,
+			    DefaultDepth(dpy, screen));
+		XCopyArea(dpy, c->cold->drawable, t->pm, dc.gc, 0, 0, c->w, c->th, 0, 0);
+		t->w = c->w;
+		t->tags = *c->tags;
+		strcpy(t->name, c->cold->name);
+		for (i = 0; i < LastBtn; i++)
+			t->bx[i] = button[i].x;
+	}
+	XCopyArea(dpy, c->cold->drawable, c->title, dc.gc, 0, 0, c->w, dc.h, 0, 0);
+#ifdef DEBUG
+	drawstats(&t0, False);
+#endif
+}
+
+void
+freetitles(Client *c) {
+	unsigned int i;
+
+	for (i = 0; i < LENGTH(c->cold->titles); i++) {
+		if (c->cold->titles[i].pm)
+			XFreePixmap(dpy, c->cold->titles[i].pm);
+		c->cold->titles[i].pm = None;
+	}
+}
+
+/* the outline is made of windows of its own, so whatever else draws
+ * meanwhile can neither damage it nor be damaged by it */
+void
+drawoutline(Client * c, int x, int y, int w, int h) {
+	int b = c->border ? c->border : 1;
+
+	w += 2 * c->border;
+	h += 2 * c->border;
+	XMoveResizeWindow(dpy, dc.outline[0], x, y, w, b);
+	XMoveResizeWindow(dpy, dc.outline[1], x, y + h - b, w, b);
+	XMoveResizeWindow(dpy, dc.outline[2], x, y, b, h);
+	XMoveResizeWindow(dpy, dc.outline[3], x + w - b, y, b, h);
+	XMapRaised(dpy, dc.outline[0]);
+	XMapRaised(dpy, dc.outline[1]);
+	XMapRaised(dpy, dc.outline[2]);
+	XMapRaised(dpy, dc.outline[3]);
+}
+
+void
+hideoutline(void) {
+	unsigned int i;
+
+	for (i = 0; i < LENGTH(dc.outline); i++)
+		XUnmapWindow(dpy, dc.outline[i]);
+}
+
+#define ISSEP(_c)	((_c) == ' ' || (_c) == '-')
+
+static void
+addtitleop(char which, int align) {
+	titleops[ntitleops].which = which;
+	titleops[ntitleops].align = align;
+	ntitleops++;
+}
+
+static void
+inittitle(const char *layout) {
+	size_t i, n = strlen(layout);
+
+	ntitleops = 0;
+	for (i = 0; i < n && !ISSEP(layout[i]); i++)
+		addtitleop(layout[i], AlignLeft);
+	if (i == n)
+		return;
+	for (i++; i < n && !ISSEP(layout[i]); i++)
+		addtitleop(layout[i], AlignCenter);
+	if (i >= n)
+		return;
+	for (i = n; i-- && !ISSEP(layout[i]);)
+		addtitleop(layout[i], AlignRight);
 }
 
 static unsigned long
@@ -265,6 +442,8 @@ initbuttons() {
 
 static void
 initfont(const char *fontstr) {
+	int i;
+
 	style.font = NULL;
 	style.font = XftFontOpenXlfd(dpy, screen, fontstr);
 	if (!style.font)
@@ -277,10 +456,15 @@ initfont(const char *fontstr) {
 	dc.font.height = style.font->ascent + style.font->descent + 1;
 	dc.font.ascent = style.font->ascent;
 	dc.font.descent = style.font->descent;
+	for (i = 0; i < GLYPHTAB; i++)
+		dc.glyphs[i].ch = GLYPHNONE;
 }
 
 void
 initstyle() {
+	XSetWindowAttributes wa;
+	unsigned int i;
+
 	style.color.norm[ColBorder] = getcolor(getresource("normal.border", NORMBORDERCOLOR));
 	style.color.norm[ColBG] = getcolor(getresource("normal.bg", NORMBGCOLOR));
 	style.color.norm[ColFG] = getcolor(getresource("normal.fg", NORMFGCOLOR));
@@ -306,15 +490,25 @@ initstyle() {
 	strncpy(style.titlelayout, getresource("titlelayout", "N  IMC"),
 	    LENGTH(style.titlelayout));
 	style.titlelayout[LENGTH(style.titlelayout) - 1] = '\0';
+	inittitle(style.titlelayout);
 	style.titleheight = atoi(getresource("title", STR(TITLEHEIGHT)));
 	if (!style.titleheight)
 		style.titleheight = dc.font.height + 2;
 	dc.gc = XCreateGC(dpy, root, 0, 0);
+	wa.override_redirect = True;
+	wa.background_pixel = style.color.sel[ColBorder];
+	for (i = 0; i < LENGTH(dc.outline); i++)
+		dc.outline[i] = XCreateWindow(dpy, root, 0, 0, 1, 1, 0,
+		    DefaultDepth(dpy, screen), InputOutput,
+		    DefaultVisual(dpy, screen), CWOverrideRedirect | CWBackPixel,
+		    &wa);
 	initbuttons();
 }
 
 void
 deinitstyle() {	
+	unsigned int i;
+
 	/* XXX: more to do */
 	XftColorFree(dpy, DefaultVisual(dpy, screen), DefaultColormap(dpy,
 		screen), style.color.font[Normal]);
@@ -323,13 +517,37 @@ deinitstyle() {
 	XftFontClose(dpy, style.font);
 	free(dc.font.extents);
 	XFreeGC(dpy, dc.gc);
+	for (i = 0; i < LENGTH(dc.outline); i++)
+		XDestroyWindow(dpy, dc.outline[i]);
 }
 
+static int
+glyphw(FcChar32 ch) {
+	Advance *g = &dc.glyphs[ch % GLYPHTAB];
+	XGlyphInfo ext;
+
+	if (g->ch != ch) {
+		XftTextExtents32(dpy, style.font, &ch, 1, &ext);
+		g->ch = ch;
+		g->w = ext.xOff;
+	}
+	return g->w;
+}
+
+/* Xft adds up glyph advances without kerning, so the cache gives the
+ * same widths as XftTextExtentsUtf8() */
 static unsigned int
 textnw(const char *text, unsigned int len) {
-	XftTextExtentsUtf8(dpy, style.font,
-	    (const unsigned char *) text, len, dc.font.extents);
-	return dc.font.extents->xOff;
+	unsigned int w = 0;
+	FcChar32 ch;
+	int l;
+
+	while (len && (l = FcUtf8ToUcs4((FcChar8 *) text, &ch, len)) > 0) {
+		w += glyphw(ch);
+		text += l;
+		len -= l;
+	}
+	return w;
 }
 
 static unsigned int
@@ -11,18 +11,30 @@
  * event dispatching in O(1) time.
  *
  * Each child of the root window is called a client, except windows which have
- * set the override_redirect flag.  Clients are organized in a global
+ * set the override_redirect flag.  Clients are allocated from a table that
+ * never moves them; whatever may outlive a client holds a ClientRef to it,
+ * which deref() resolves to NULL once the client is gone.  They are
+ * organized in a global
  * doubly-linked client list, the focus history is remembered through a global
- * stack list. Each client contains an array of Bools of the same size as the
- * global tags array to indicate the tags of a client.	
+ * doubly-linked stack list, so moving a client to its top is O(1).  The
+ * client, title and frame windows of every client are also kept in a hash
+ * table keyed by window id, so getclient() runs in O(1).
+ * Every tag keeps its member clients in attach order.  Every monitor caches
+ * its visible clients split into tiled, floating, iconified and bastard
+ * lists, built from the members of the tags it views.  A client change calls
+ * invalidateclient(), a view change invalidatelists(), and only the lists
+ * of the monitors involved get rebuilt on next use.
+ * Each client contains a bitset with one bit per entry of the global tags
+ * array to indicate the tags of a client.
  *
  * Keys and tagging rules are organized as arrays and defined in config.h.
  *
  * To understand everything else, start reading main().
  */
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE		/* POSIX_SPAWN_SETSID in glibc */
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/select.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <assert.h>
@@ -37,6 +49,10 @@
 #include <unistd.h>
 #include <regex.h>
 #include <signal.h>
+#include <spawn.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
 #include <X11/cursorfont.h>
 #include <X11/keysym.h>
 #include <X11/XF86keysym.h>
@@ -59,21 +75,26 @@
 #define CLIENTMASK	        (PropertyChangeMask | StructureNotifyMask | FocusChangeMask)
 #define CLIENTNOPROPAGATEMASK 	(BUTTONMASK | ButtonMotionMask)
 #define FRAMEMASK               (MOUSEMASK | SubstructureRedirectMask | SubstructureNotifyMask | EnterWindowMask | LeaveWindowMask)
+#define CLIENTCHUNK		64	/* clients per client table chunk */
 
 /* function-like macros */
-#define save(_c) { (_c)->rx = (_c)->x; \
-	       	(_c)->ry = (_c)->y; \
-		(_c)->rw = (_c)->w; \
-		(_c)->rh = (_c)->h; }
+#define save(_c) { (_c)->cold->rx = (_c)->x; \
+	       	(_c)->cold->ry = (_c)->y; \
+		(_c)->cold->rw = (_c)->w; \
+		(_c)->cold->rh = (_c)->h; }
 
 /* enums */
 enum { StrutsOn, StrutsOff, StrutsHide };		    /* struts position */
 enum { CurNormal, CurResize, CurMove, CurLast };	    /* cursor */
+enum { DragMove, DragResize };				    /* mouse operations */
 enum { Clk2Focus, SloppyFloat, AllSloppy, SloppyRaise };    /* focus model */
 
 /* function declarations */
+Client *allocclient(void);
 void applyrules(Client * c);
+void applysizehints(Client * c, int *w, int *h);
 void arrange(Monitor * m);
+Bool arrangedirty(void);
 void attach(Client * c);
 void attachstack(Client * c);
 void ban(Client * c);
@@ -81,44 +102,69 @@ void buttonpress(XEvent * e);
 void bstack(Monitor * m);
 void checkotherwm(void);
 void cleanup(void);
+int clientlayer(Client * c);
 void compileregs(void);
 void configure(Client * c);
 void configurenotify(XEvent * e);
 void configurerequest(XEvent * e);
+void deltimer(void (*func) (void *arg), void *arg);
 void destroynotify(XEvent * e);
+void dragcancel(void);
+void dragend(void);
+void dragtick(void *arg);
+void dragupdate(Bool final);
 void detach(Client * c);
 void detachstack(Client * c);
 void *emallocz(unsigned int size);
 void enternotify(XEvent * e);
 void eprint(const char *errstr, ...);
 void expose(XEvent * e);
+void filetags(Client * c, Bool attached);
 void iconify(const char *arg);
+void ignoreenter(void);
 void incnmaster(const char *arg);
 void focus(Client * c);
+void freeclient(Client * c);
 void focusnext(const char *arg);
 void focusprev(const char *arg);
-Client *getclient(Window w, Client * list, int part);
+int framedelay(Monitor * m);
+Client *getclient(Window w, int part);
 const char *getresource(const char *resource, const char *defval);
 long getstate(Window w);
 Bool gettextprop(Window w, Atom atom, char *text, unsigned int size);
 void getpointer(int *x, int *y);
+void setpointer(int x, int y);
+void trackpointer(XEvent * e);
 Monitor *getmonitor(int x, int y);
 Monitor *curmonitor();
 Monitor *clientmonitor(Client * c);
 int idxoftag(const char *tag);
 Bool isvisible(Client * c, Monitor * m);
+void tagsclear(Tags * t);
+Bool tagsempty(Tags * t);
+void tagsfill(Tags * t);
+Bool tagsintersect(Tags * a, Tags * b);
 void initmonitors(XEvent * e);
+void initsignals(void);
 void keypress(XEvent * e);
 void killclient(const char *arg);
 void leavenotify(XEvent * e);
+void listappend(ClientArray * l, Client * c);
+void listinsert(ClientArray * l, Client * c);
+void listremove(ClientArray * l, Client * c);
 void focusin(XEvent * e);
 void manage(Window w, XWindowAttributes * wa);
+void markdirty(Monitor * m, int what);
 void mappingnotify(XEvent * e);
+ClientArray *monlist(Monitor * m, int which);
 void monocle(Monitor * m);
 void maprequest(XEvent * e);
 void mousemove(Client * c);
 void mouseresize(Client * c);
+void motionnotify(XEvent * e);
 void moveresizekb(const char *arg);
+long msnow(void);
+int nexttimer(void);
 Client *nexttiled(Client * c, Monitor * m);
 Client *prevtiled(Client * c, Monitor * m);
 void place(Client *c);
@@ -127,10 +173,16 @@ void reparentnotify(XEvent * e);
 void quit(const char *arg);
 void restart(const char *arg);
 void resize(Client * c, int x, int y, int w, int h, Bool sizehints);
+void readsignals(int fd);
 void restack(Monitor * m);
 void run(void);
+Bool runtimers(void);
 void scan(void);
+unsigned int seqpos(ClientArray * l, unsigned long seq);
 void setclientstate(Client * c, long state);
+void syncalarm(XEvent * e);
+void settlefocus(void *arg);
+void settimer(void (*func) (void *arg), void *arg, long ms);
 void setlayout(const char *arg);
 void setmwfact(const char *arg);
 void setup(char *);
@@ -147,16 +199,20 @@ void togglemonitor(const char *arg);
 void focusview(const char *arg);
 void unban(Client * c);
 void unmanage(Client * c);
+void unsettle(void);
+void unwatchfd(int fd);
 void updategeom(Monitor * m);
 void updatestruts(Monitor * m);
 void unmapnotify(XEvent * e);
 void updatesizehints(Client * c);
 void updateframe(Client * c);
 void updatetitle(Client * c);
+void updatewmhints(Client * c);
 void view(const char *arg);
 void viewprevtag(const char *arg);	/* views previous selected tags */
 void viewlefttag(const char *arg);
 void viewrighttag(const char *arg);
+void watchfd(int fd, void (*func) (int fd));
 int xerror(Display * dpy, XErrorEvent * ee);
 int xerrordummy(Display * dsply, XErrorEvent * ee);
 int xerrorstart(Display * dsply, XErrorEvent * ee);
@@ -164,6 +220,7 @@ int (*xerrorxlib) (Display *, XErrorEvent *);
 void zoom(const char *arg);
 
 /* variables */
+extern char **environ;
 char **cargv;
 Display *dpy;
 int screen;
@@ -176,6 +233,37 @@ Monitor *monitors;
 Client *clients;
 Client *sel;
 Client *stack;
+ClientWin **wintab;
+unsigned int nwintab, nwins;
+unsigned long viewgen = 1;	/* bumped when a monitor's view changes */
+ClientArray *taglists;		/* per tag, by seq, bastards left out */
+ClientArray bastards;		/* by seq */
+unsigned long attachseq;
+Monitor *lastmon;
+int ptrx, ptry;
+Bool ptrvalid;
+unsigned long enterserial;
+ClientRef focuswait;	/* sloppy focus waiting for the pointer to settle */
+Client **clienttab;	/* chunks of CLIENTCHUNK, see allocclient() */
+unsigned int nclienttab;
+Client *freeclients;
+Timer *timers;		/* sorted by due */
+struct pollfd *watches;
+void (**watchfuncs) (int fd);
+int nwatches, swatches;
+int sigpipe[2];
+int nchildren;		/* spawned and not reaped yet */
+struct {
+	Client *c;		/* being dragged, NULL when idle */
+	int op;			/* DragMove or DragResize */
+	Monitor *m;		/* where the drag started */
+	int x1, y1;		/* pointer at the start */
+	int ocx, ocy;		/* client origin at the start */
+	int ox, oy, ow, oh;	/* wireframe outline */
+	Bool drawn;		/* the outline is on the screen */
+	Bool pending;		/* the pointer moved since the last commit */
+	long due;		/* msnow() of the next commit */
+} drag;
 Cursor cursor[CurLast];
 Style style;
 Button button[LastBtn];
@@ -183,7 +271,8 @@ View *views;
 Key **keys;
 Rule **rules;
 char **tags;
-unsigned int ntags;
+int *tagtab;
+unsigned int ntags, ntagtab;
 unsigned int nkeys;
 unsigned int nrules;
 unsigned int modkey;
@@ -194,7 +283,10 @@ unsigned int numlockmask;
 struct {
 	Bool dectiled;
 	Bool hidebastards;
+	Bool grabarrange;
+	Bool wireframe;
 	int focus;
+	int focusdelay;
 	int snap;
 	char command[255];
 } options;
@@ -222,6 +314,7 @@ void (*handler[LASTEvent]) (XEvent *) = {
 	[KeyPress] = keypress,
 	[MappingNotify] = mappingnotify,
 	[MapRequest] = maprequest,
+	[MotionNotify] = motionnotify,
 	[PropertyNotify] = propertynotify,
 	[ReparentNotify] = reparentnotify,
 	[UnmapNotify] = unmapnotify,
@@ -241,18 +334,20 @@ applyrules(Client * c) {
 	XClassHint ch = { 0 };
 
 	/* rule matching */
-	XGetClassHint(dpy, c->win, &ch);
+	getclasshint(c->win, &ch);
 	snprintf(buf, sizeof(buf), "%s:%s:%s",
-	    ch.res_class ? ch.res_class : "", ch.res_name ? ch.res_name : "", c->name);
+	    ch.res_class ? ch.res_class : "", ch.res_name ? ch.res_name : "", c->cold->name);
 	buf[LENGTH(buf)-1] = 0;
 	for (i = 0; i < nrules; i++)
 		if (rules[i]->propregex && !regexec(rules[i]->propregex, buf, 1, &tmp, 0)) {
 			c->isfloating = rules[i]->isfloating;
 			c->title = rules[i]->hastitle;
+			if (rules[i]->wireframe >= 0)
+				c->cold->wireframe = rules[i]->wireframe;
 			for (j = 0; rules[i]->tagregex && j < ntags; j++) {
 				if (!regexec(rules[i]->tagregex, tags[j], 1, &tmp, 0)) {
 					matched = True;
-					c->tags[j] = True;
+					SETTAG(c->tags, j);
 				}
 			}
 		}
@@ -261,30 +356,36 @@ applyrules(Client * c) {
 	if (ch.res_name)
 		XFree(ch.res_name);
 	if (!matched)
-		memcpy(c->tags, curseltags, ntags * sizeof(curseltags[0]));
+		*c->tags = curseltags;
 }
 
 void
 arrangefloats(Monitor * m) {
+	ClientArray *l;
 	Client *c;
 	Monitor *om;
 	int dx, dy;
+	unsigned int i, j;
 
-	for (c = stack; c; c = c->snext) {
-		if (isvisible(c, m) && !c->isbastard &&
-			       	(c->isfloating || MFEATURES(m, OVERLAP))
-			       	&& !c->ismax && !c->isicon) {
-			DPRINTF("%d %d\n", c->rx, c->ry);
-			if (!(om = getmonitor(c->rx + c->rw/2,
-				       	c->ry + c->rh/2)))
+	for (j = TiledList; j <= FloatList; j++) {
+		if (j == TiledList && !MFEATURES(m, OVERLAP))
+			continue;
+		l = monlist(m, j);
+		for (i = 0; i < l->n; i++) {
+			c = l->c[i];
+			if (c->ismax)
+				continue;
+			DPRINTF("%d %d\n", c->cold->rx, c->cold->ry);
+			if (!(om = getmonitor(c->cold->rx + c->cold->rw/2,
+				       	c->cold->ry + c->cold->rh/2)))
 				continue;
-			dx = om->sx + om->sw - c->rx;
-			dy = om->sy + om->sh - c->ry;
+			dx = om->sx + om->sw - c->cold->rx;
+			dy = om->sy + om->sh - c->cold->ry;
 			if (dx > m->sw) 
 				dx = m->sw;
 			if (dy > m->sh) 
 				dy = m->sh;
-			resize(c, m->sx + m->sw - dx, m->sy + m->sh - dy, c->rw, c->rh, True);
+			resize(c, m->sx + m->sw - dx, m->sy + m->sh - dy, c->cold->rw, c->cold->rh, True);
 			save(c);
 		}
 	}
@@ -292,36 +393,73 @@ arrangefloats(Monitor * m) {
 
 void
 arrangemon(Monitor * m) {
+	ClientArray *l;
 	Client *c;
-
-	if (views[m->curtag].layout->arrange)
-		views[m->curtag].layout->arrange(m);
-	arrangefloats(m);
-	restack(m);
-	for (c = stack; c; c = c->snext) {
-		if ((clientmonitor(c) == m) && ((!c->isbastard && !c->isicon) ||
-			(c->isbastard && views[m->curtag].barpos == StrutsOn))) {
-			unban(c);
+	unsigned int i, j;
+	int what;
+
+	what = m->dirty;
+	m->dirty = 0;
+	if (what & DirtyLayout) {
+		if (views[m->curtag].layout->arrange)
+			views[m->curtag].layout->arrange(m);
+		arrangefloats(m);
+	}
+	if (what & DirtyStack)
+		restack(m);
+	if (!(what & DirtyVisible))
+		return;
+	for (j = 0; j < LastList; j++) {
+		l = monlist(m, j);
+		for (i = 0; i < l->n; i++) {
+			switch (j) {
+			case IconList:
+				ban(l->c[i]);
+				break;
+			case BastardList:
+				if (views[m->curtag].barpos == StrutsOn)
+					unban(l->c[i]);
+				else if (views[m->curtag].barpos == StrutsHide)
+					ban(l->c[i]);
+				break;
+			default:
+				unban(l->c[i]);
+				break;
+			}
 		}
 	}
-
-	for (c = stack; c; c = c->snext) {
-		if ((clientmonitor(c) == NULL) || (!c->isbastard && c->isicon) ||
-			(c->isbastard && views[m->curtag].barpos == StrutsHide)) {
+	for (c = clients; c; c = c->next)
+		if (!isvisible(c, NULL))
 			ban(c);
-		}
-	}
 }
 
 void
 arrange(Monitor * m) {
-	Monitor *i;
+	/* nothing is moved here: run() calls arrangedirty() once the
+	 * pending events are handled, so a burst of changes costs one
+	 * arrange per affected monitor */
+	markdirty(m, DirtyLayout | DirtyStack | DirtyVisible);
+}
 
-	if (!m) {
-		for (i = monitors; i; i = i->next)
-			arrangemon(i);
-	} else
-		arrangemon(m);
+Bool
+arrangedirty(void) {
+	Monitor *m;
+
+	for (m = monitors; m && !m->dirty; m = m->next);
+	if (!m)
+		return False;
+	/* resize() only queues requests for what changed; optionally apply
+	 * the whole layout atomically and push it out in one go */
+	if (options.grabarrange)
+		XGrabServer(dpy);
+	for (m = monitors; m; m = m->next)
+		if (m->dirty)
+			arrangemon(m);
+	if (options.grabarrange)
+		XUngrabServer(dpy);
+	ignoreenter();
+	XFlush(dpy);
+	return True;
 }
 
 void
@@ -330,10 +468,17 @@ attach(Client * c) {
 		clients->prev = c;
 	c->next = clients;
 	clients = c;
+	c->seq = ++attachseq;
+	if (c->isbastard)
+		listinsert(&bastards, c);
+	invalidateclient(c);
 }
 
 void
 attachstack(Client * c) {
+	if (stack)
+		stack->sprev = c;
+	c->sprev = NULL;
 	c->snext = stack;
 	stack = c;
 }
@@ -342,7 +487,7 @@ void
 ban(Client * c) {
 	if (c->isbanned)
 		return;
-	c->ignoreunmap++;
+	c->cold->ignoreunmap++;
 	setclientstate(c, IconicState);
 	XSelectInput(dpy, c->win, CLIENTMASK & ~(StructureNotifyMask | EnterWindowMask));
 	XSelectInput(dpy, c->frame, NoEventMask);
@@ -359,6 +504,11 @@ buttonpress(XEvent * e) {
 	int i;
 	XButtonPressedEvent *ev = &e->xbutton;
 
+	if (drag.c) {
+		if (ev->type == ButtonRelease)
+			dragend();
+		return;
+	}
 	if (!curmonitor())
 		return;
 	if (ev->window == root) {
@@ -377,8 +527,8 @@ buttonpress(XEvent * e) {
 		}
 		return;
 	}
-	if ((c = getclient(ev->window, clients, ClientTitle))) {
-		DPRINTF("TITLE %s: 0x%x\n", c->name, (int) ev->window);
+	if ((c = getclient(ev->window, ClientTitle))) {
+		DPRINTF("TITLE %s: 0x%x\n", c->cold->name, (int) ev->window);
 		focus(c);
 		for (i = 0; i < LastBtn; i++) {
 			if (button[i].action == NULL)
@@ -405,16 +555,16 @@ buttonpress(XEvent * e) {
 		if (ev->type == ButtonRelease)
 			return;
 		if (FEATURES(curlayout, OVERLAP) || c->isfloating)
-			XRaiseWindow(dpy, c->frame);
+			markdirty(curmonitor(), DirtyStack);
 		if (ev->button == Button1)
 			mousemove(c);
 		else if (ev->button == Button3)
 			mouseresize(c);
-	} else if ((c = getclient(ev->window, clients, ClientWindow))) {
-		DPRINTF("WINDOW %s: 0x%x\n", c->name, (int) ev->window);
+	} else if ((c = getclient(ev->window, ClientWindow))) {
+		DPRINTF("WINDOW %s: 0x%x\n", c->cold->name, (int) ev->window);
 		focus(c);
 		if (FEATURES(curlayout, OVERLAP) || c->isfloating)
-			XRaiseWindow(dpy, c->frame);
+			markdirty(curmonitor(), DirtyStack);
 		if (CLEANMASK(ev->state) != modkey) {
 			XAllowEvents(dpy, ReplayPointer, CurrentTime);
 			return;
@@ -437,8 +587,8 @@ buttonpress(XEvent * e) {
 				togglemax(NULL);
 			mouseresize(c);
 		}
-	} else if ((c = getclient(ev->window, clients, ClientFrame))) {
-		DPRINTF("FRAME %s: 0x%x\n", c->name, (int) ev->window);
+	} else if ((c = getclient(ev->window, ClientFrame))) {
+		DPRINTF("FRAME %s: 0x%x\n", c->cold->name, (int) ev->window);
 		/* Not supposed to happen */
 	}
 }
@@ -466,7 +616,11 @@ cleanup(void) {
 		unmanage(stack);
 	}
 	free(tags);
+	free(tagtab);
 	free(keys);
+	free(wintab);
+	wintab = NULL;
+	nwintab = nwins = 0;
 	initmonitors(NULL);
 	/* free resource database */
 	XrmDestroyDatabase(xrdb);
@@ -511,7 +665,8 @@ configurenotify(XEvent * e) {
 			for (c = clients; c; c = c->next) {
 				if (c->isbastard) {
 					m = getmonitor(c->x + c->w/2, c->y);
-					c->tags = m->seltags;
+					c->tags = &m->seltags;
+					invalidateclient(c);
 					updatestruts(m);
 				}
 			}
@@ -532,7 +687,7 @@ configurerequest(XEvent * e) {
 	Monitor *cm;
 	int x, y, w, h;
 
-	if ((c = getclient(ev->window, clients, ClientWindow))) {
+	if ((c = getclient(ev->window, ClientWindow))) {
 		c->ismax = False;
 		cm = clientmonitor(c);
 		if (ev->value_mask & CWBorderWidth)
@@ -549,21 +704,21 @@ configurerequest(XEvent * e) {
 			cm = getmonitor(x, y);
 			if (!(ev->value_mask & (CWX | CWY)) /* resize request */
 			    && (ev->value_mask & (CWWidth | CWHeight))) {
-				DPRINTF("RESIZE %s (%d,%d)->(%d,%d)\n", c->name, c->w, c->h, w, h);
+				DPRINTF("RESIZE %s (%d,%d)->(%d,%d)\n", c->cold->name, c->w, c->h, w, h);
 				resize(c, c->x, c->y, w, h, True);
 			} else if ((ev->value_mask & (CWX | CWY)) /* move request */
 			    && !(ev->value_mask & (CWWidth | CWHeight))) {
-				DPRINTF("MOVE %s (%d,%d)->(%d,%d)\n", c->name, c->x, c->y, x, y);
+				DPRINTF("MOVE %s (%d,%d)->(%d,%d)\n", c->cold->name, c->x, c->y, x, y);
 				resize(c, x, y, c->w, c->h, True);
 				save(c);
 			} else if ((ev->value_mask & (CWX | CWY)) /* move and resize request */
 			    && (ev->value_mask & (CWWidth | CWHeight))) {
-				DPRINTF("MOVE&RESIZE(MOVE) %s (%d,%d)->(%d,%d)\n", c->name, c->x, c->y, ev->x, ev->y);
-				DPRINTF("MOVE&RESIZE(RESIZE) %s (%d,%d)->(%d,%d)\n", c->name, c->w, c->h, ev->width, ev->height);
+				DPRINTF("MOVE&RESIZE(MOVE) %s (%d,%d)->(%d,%d)\n", c->cold->name, c->x, c->y, ev->x, ev->y);
+				DPRINTF("MOVE&RESIZE(RESIZE) %s (%d,%d)->(%d,%d)\n", c->cold->name, c->w, c->h, ev->width, ev->height);
 				resize(c, x, y, w, h, True);
 				save(c);
 			} else if ((ev->value_mask & CWStackMode)) {
-				DPRINTF("RESTACK %s ignoring\n", c->name);
+				DPRINTF("RESTACK %s ignoring\n", c->cold->name);
 				configure(c);
 			}
 		} else {
@@ -587,14 +742,28 @@ destroynotify(XEvent * e) {
 	Client *c;
 	XDestroyWindowEvent *ev = &e->xdestroywindow;
 
-	if (!(c = getclient(ev->window, clients, ClientWindow)))
+	if (!(c = getclient(ev->window, ClientWindow)))
 		return;
 	unmanage(c);
-	updateatom[ClientList] (NULL);
 }
 
 void
 detach(Client * c) {
+	Monitor *m;
+	int i;
+
+	/* no monitor list may keep pointing to it */
+	for (m = monitors; m; m = m->next)
+		if (c->inlists & MONBIT(m)) {
+			for (i = 0; i < LastList; i++)
+				listremove(&m->lists[i], c);
+			m->listsvalid = False;
+		}
+	c->inlists = 0;
+	c->mongen = 0;
+	filetags(c, False);
+	if (c->isbastard)
+		listremove(&bastards, c);
 	if (c->prev)
 		c->prev->next = c->next;
 	if (c->next)
@@ -606,10 +775,13 @@ detach(Client * c) {
 
 void
 detachstack(Client * c) {
-	Client **tc;
-
-	for (tc = &stack; *tc && *tc != c; tc = &(*tc)->snext);
-	*tc = c->snext;
+	if (c->sprev)
+		c->sprev->snext = c->snext;
+	if (c->snext)
+		c->snext->sprev = c->sprev;
+	if (c == stack)
+		stack = c->snext;
+	c->snext = c->sprev = NULL;
 }
 
 void *
@@ -621,6 +793,52 @@ emallocz(unsigned int size) {
 	return res;
 }
 
+void *
+erealloc(void *ptr, unsigned int size) {
+	void *res = realloc(ptr, size);
+
+	if (!res)
+		eprint("fatal: could not realloc() %u bytes\n", size);
+	return res;
+}
+
+/* crossing events caused by the requests sent so far are ours */
+void
+ignoreenter(void) {
+	enterserial = NextRequest(dpy);
+	/* bump the serial, so that later crossings are told apart */
+	XNoOp(dpy);
+}
+
+void
+unsettle(void) {
+	ClientRef none = { 0, 0 };
+
+	if (deref(focuswait))
+		deltimer(settlefocus, NULL);
+	focuswait = none;
+}
+
+void
+settlefocus(void *arg) {
+	Client *c;
+	int x, y;
+
+	/* gone meanwhile */
+	if (!(c = deref(focuswait)))
+		return;
+	/* it may have moved on without a crossing we act on */
+	getpointer(&x, &y);
+	if (x < c->x || x >= c->x + c->w + 2 * c->border ||
+	    y < c->y || y >= c->y + c->h + 2 * c->border) {
+		unsettle();
+		return;
+	}
+	focus(c);
+	if (options.focus == SloppyRaise)
+		markdirty(curmonitor(), DirtyStack);
+}
+
 void
 enternotify(XEvent * e) {
 	XCrossingEvent *ev = &e->xcrossing;
@@ -628,34 +846,42 @@ enternotify(XEvent * e) {
 
 	if (ev->mode != NotifyNormal || ev->detail == NotifyInferior)
 		return;
+	/* we moved the window under the pointer, the pointer didn't move */
+	if ((long) (ev->serial - enterserial) < 0)
+		return;
 	if (!curmonitor())
 		return;
-	if ((c = getclient(ev->window, clients, ClientFrame))) {
+	if ((c = getclient(ev->window, ClientFrame))) {
 #if 0 /* WTF ? */
 		if (!isvisible(sel, curmonitor()))
 			focus(c);
 #endif 
-		if (c->isbastard)
+		if (c->isbastard) {
+			unsettle();
 			return;
+		}
 		switch (options.focus) {
 		case Clk2Focus:
 			break;
 		case SloppyFloat:
-			if (FEATURES(curlayout, OVERLAP) || c->isfloating)
-				focus(c);
-			break;
+			if (!FEATURES(curlayout, OVERLAP) && !c->isfloating)
+				break;
+			/* fall through */
 		case AllSloppy:
-			focus(c);
-			break;
 		case SloppyRaise:
-			focus(c);
-			restack(curmonitor());
+			/* sweeping across windows shouldn't focus each one */
+			focuswait = clientref(c);
+			if (options.focusdelay > 0)
+				settimer(settlefocus, NULL, options.focusdelay);
+			else
+				settlefocus(NULL);
 			break;
 		}
 	} else if (ev->window == root) {
 		selscreen = True;
 		focus(NULL);
-	}
+	} else
+		unsettle();
 }
 
 void
@@ -673,7 +899,7 @@ focusin(XEvent * e) {
 	XFocusChangeEvent *ev = &e->xfocus;
 	Client *c;
 
-	if (sel && ((c = getclient(ev->window, clients, ClientWindow)) != sel))
+	if (sel && ((c = getclient(ev->window, ClientWindow)) != sel))
 		XSetInputFocus(dpy, sel->win, RevertToPointerRoot, CurrentTime);
 	else if (!c)
 		fprintf(stderr, "Caught FOCUSIN for unknown window 0x%x\n", ev->window);
@@ -686,14 +912,14 @@ expose(XEvent * e) {
 	Client *c;
 
 	while (XCheckWindowEvent(dpy, ev->window, ExposureMask, &tmp));
-	if ((c = getclient(ev->window, clients, ClientTitle)))
+	if ((c = getclient(ev->window, ClientTitle)))
 		drawclient(c);
 }
 
 void
 givefocus(Client * c) {
 	XEvent ce;
-	if (checkatom(c->win, atom[WMProto], atom[WMTakeFocus])) {
+	if (c->cold->protocols & ProtoTakeFocus) {
 		ce.xclient.type = ClientMessage;
 		ce.xclient.message_type = atom[WMProto];
 		ce.xclient.display = dpy;
@@ -712,6 +938,7 @@ void
 focus(Client * c) {
 	Client *o;
 
+	unsettle();
 	o = sel;
 	if ((!c && selscreen) || (c && (c->isbastard || !isvisible(c, curmonitor()))))
 		for (c = stack;
@@ -730,7 +957,9 @@ focus(Client * c) {
 	if (c) {
 		setclientstate(c, NormalState);
 		if (c->isfocusable) {
-			XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
+			/* banned clients get it from unban() once mapped */
+			if (!c->isbanned)
+				XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
 			givefocus(c);
 		}
 		XSetWindowBorder(dpy, sel->frame, style.color.sel[ColBorder]);
@@ -741,18 +970,20 @@ focus(Client * c) {
 	if (o)
 		drawclient(o);
 	updateatom[ActiveWindow] (sel);
-	updateatom[ClientList] (NULL);
 	updateatom[CurDesk] (NULL);
 }
 
 void
 focusicon(const char *arg) {
+	ClientArray *l;
 	Client *c;
 
-	for (c = clients; c && (!c->isicon || !isvisible(c, curmonitor())); c = c->next);
-	if (!c)
+	l = monlist(curmonitor(), IconList);
+	if (!l->n)
 		return;
+	c = l->c[0];
 	c->isicon = False;
+	invalidateclient(c);
 	focus(c);
 	arrange(curmonitor());
 }
@@ -771,7 +1002,7 @@ focusnext(const char *arg) {
 			|| !isvisible(c, curmonitor())); c = c->next);
 	if (c) {
 		focus(c);
-		restack(curmonitor());
+		markdirty(curmonitor(), DirtyStack);
 	}
 }
 
@@ -791,7 +1022,7 @@ focusprev(const char *arg) {
 	}
 	if (c) {
 		focus(c);
-		restack(curmonitor());
+		markdirty(curmonitor(), DirtyStack);
 	}
 }
 
@@ -804,6 +1035,7 @@ iconify(const char *arg) {
 	focusnext(NULL);
 	ban(c);
 	c->isicon = True;
+	invalidateclient(c);
 	arrange(curmonitor());
 }
 
@@ -826,17 +1058,130 @@ incnmaster(const char *arg) {
 		arrange(curmonitor());
 }
 
+static unsigned int
+winhash(Window w) {
+	/* fold the resource base into the per-client counter bits */
+	return ((unsigned int)(w ^ (w >> 21)) * 0x9e3779b1U) & (nwintab - 1);
+}
+
+/* Clients are kept in a table of chunks that never move, so a Client
+ * pointer stays good for as long as the client is managed.  A slot gets
+ * a new generation each time it is taken or given back; a ClientRef
+ * taken while the client was managed resolves to NULL ever after. */
+Client *
+allocclient(void) {
+	Client *c;
+	ClientCold *cold;
+	unsigned int i, slot, gen;
+
+	if (!freeclients) {
+		clienttab = erealloc(clienttab, (nclienttab / CLIENTCHUNK + 1) *
+		    sizeof(Client *));
+		c = emallocz(CLIENTCHUNK * sizeof(Client));
+		/* the cold parts in a chunk of their own, same slot order */
+		cold = emallocz(CLIENTCHUNK * sizeof(ClientCold));
+		clienttab[nclienttab / CLIENTCHUNK] = c;
+		/* handed out lowest first */
+		for (i = CLIENTCHUNK; i--;) {
+			c[i].slot = nclienttab + i;
+			c[i].cold = &cold[i];
+			c[i].next = freeclients;
+			freeclients = &c[i];
+		}
+		nclienttab += CLIENTCHUNK;
+	}
+	c = freeclients;
+	freeclients = c->next;
+	slot = c->slot;
+	gen = c->gen + 1;
+	cold = c->cold;
+	memset(c, 0, sizeof(Client));
+	memset(cold, 0, sizeof(ClientCold));
+	c->slot = slot;
+	c->gen = gen;
+	c->cold = cold;
+	return c;
+}
+
+void
+freeclient(Client * c) {
+	c->gen++;
+	c->next = freeclients;
+	freeclients = c;
+}
+
+ClientRef
+clientref(Client * c) {
+	ClientRef r;
+
+	r.slot = c->slot;
+	r.gen = c->gen;
+	return r;
+}
+
 Client *
-getclient(Window w, Client * list, int part) {
+deref(ClientRef r) {
 	Client *c;
 
-#define ClientPart(_c, _part) (((_part) == ClientWindow) ? (_c)->win : \
-			       ((_part) == ClientTitle) ? (_c)->title : \
-			       ((_part) == ClientFrame) ? (_c)->frame : 0)
+	if (!(r.gen & 1) || r.slot >= nclienttab)
+		return NULL;
+	c = &clienttab[r.slot / CLIENTCHUNK][r.slot % CLIENTCHUNK];
+	return c->gen == r.gen ? c : NULL;
+}
+
+void
+addwin(Window w, Client * c, int part) {
+	ClientWin **otab, *cw, *n;
+	unsigned int i, osize;
 
-	for (c = list; c && (ClientPart(c, part)) != w; c = c->next);
+	if (nwins >= nwintab) {
+		/* keep the load factor below one */
+		otab = wintab;
+		osize = nwintab;
+		nwintab = nwintab ? nwintab * 2 : 64;
+		wintab = emallocz(nwintab * sizeof(ClientWin *));
+		for (i = 0; i < osize; i++)
+			for (cw = otab[i]; cw; cw = n) {
+				n = cw->next;
+				cw->next = wintab[winhash(cw->w)];
+				wintab[winhash(cw->w)] = cw;
+			}
+		free(otab);
+	}
+	cw = emallocz(sizeof(ClientWin));
+	cw->w = w;
+	cw->c = c;
+	cw->part = part;
+	cw->next = wintab[winhash(w)];
+	wintab[winhash(w)] = cw;
+	nwins++;
+}
 
-	return c;
+void
+delwin(Window w) {
+	ClientWin **pcw, *cw;
+
+	if (!nwintab)
+		return;
+	for (pcw = &wintab[winhash(w)]; (cw = *pcw); pcw = &cw->next)
+		if (cw->w == w) {
+			*pcw = cw->next;
+			free(cw);
+			nwins--;
+			return;
+		}
+}
+
+Client *
+getclient(Window w, int part) {
+	ClientWin *cw;
+
+	if (!nwintab || w == None)
+		return NULL;
+	for (cw = wintab[winhash(w)]; cw; cw = cw->next)
+		if (cw->w == w)
+			return cw->part == part ? cw->c : NULL;
+	return NULL;
 }
 
 long
@@ -874,9 +1219,12 @@ gettextprop(Window w, Atom atom, char *text, unsigned int size) {
 	if (!text || size == 0)
 		return False;
 	text[0] = '\0';
-	XGetTextProperty(dpy, w, &name, atom);
-	if (!name.nitems)
+	name.value = getprop(w, atom, 1024L, &name.encoding, &name.format,
+	    &name.nitems);
+	if (!name.nitems) {
+		XFree(name.value);
 		return False;
+	}
 	if (name.encoding == XA_STRING) {
 		strncpy(text, (char *) name.value, size - 1);
 	} else {
@@ -891,31 +1239,152 @@ gettextprop(Window w, Atom atom, char *text, unsigned int size) {
 	return True;
 }
 
+static unsigned int
+taghash(const char *tag) {
+	unsigned int h = 5381;
+
+	while (*tag)
+		h = h * 33 + (unsigned char) *tag++;
+	return h & (ntagtab - 1);
+}
+
 int
 idxoftag(const char *tag) {
+	unsigned int h;
+
+	if (!tag)
+		return 0;
+	/* open addressing, tagtab[] holds tag index + 1 */
+	for (h = taghash(tag); tagtab[h]; h = (h + 1) & (ntagtab - 1))
+		if (tag == tags[tagtab[h] - 1] || !strcmp(tag, tags[tagtab[h] - 1]))
+			return tagtab[h] - 1;
+	return 0;
+}
+
+/* a view changed: m's lists, or every monitor's when m is NULL */
+void
+invalidatelists(Monitor * m) {
+	viewgen++;
+	if (m)
+		m->listsvalid = False;
+	else
+		for (m = monitors; m; m = m->next)
+			m->listsvalid = False;
+}
+
+/* c's tags, floating or icon state changed: refile it and drop the lists
+ * of the monitors it was listed on or is visible on now */
+void
+invalidateclient(Client * c) {
+	Monitor *m;
+
+	filetags(c, True);
+	c->mongen = 0;
+	for (m = monitors; m; m = m->next)
+		if ((c->inlists & MONBIT(m)) || isvisible(c, m))
+			m->listsvalid = False;
+}
+
+/* keeps c in the taglists of its tags, and only those */
+void
+filetags(Client * c, Bool attached) {
+	Tags now;
 	unsigned int i;
 
-	for (i = 0; (i < ntags) && strcmp(tag, tags[i]); i++);
-	return (i < ntags) ? i : 0;
+	tagsclear(&now);
+	if (attached && !c->isbastard)
+		now = *c->tags;
+	for (i = 0; i < ntags; i++) {
+		if (ISTAGGED(&c->cold->listed, i) && !ISTAGGED(&now, i))
+			listremove(&taglists[i], c);
+		else if (!ISTAGGED(&c->cold->listed, i) && ISTAGGED(&now, i))
+			listinsert(&taglists[i], c);
+	}
+	c->cold->listed = now;
 }
 
-Bool
-isvisible(Client * c, Monitor * m) {
+/* taglists and bastards are sorted by seq */
+unsigned int
+seqpos(ClientArray * l, unsigned long seq) {
+	unsigned int lo = 0, hi = l->n, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (l->c[mid]->seq < seq)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+void
+listinsert(ClientArray * l, Client * c) {
+	unsigned int i = seqpos(l, c->seq);
+
+	if (l->n == l->size) {
+		l->size = l->size ? l->size * 2 : 16;
+		l->c = erealloc(l->c, l->size * sizeof(Client *));
+	}
+	memmove(l->c + i + 1, l->c + i, (l->n - i) * sizeof(Client *));
+	l->c[i] = c;
+	l->n++;
+}
+
+/* also takes it out of the unsorted monitor lists */
+void
+listremove(ClientArray * l, Client * c) {
 	unsigned int i;
 
+	for (i = 0; i < l->n && l->c[i] != c; i++);
+	if (i == l->n)
+		return;
+	memmove(l->c + i, l->c + i + 1, (--l->n - i) * sizeof(Client *));
+}
+
+Bool
+isvisible(Client * c, Monitor * m) {
 	if (!c)
 		return False;
-	if (!m) {
-		for (m = monitors; m; m = m->next) {
-			for (i = 0; i < ntags; i++)
-				if (c->tags[i] && m->seltags[i])
-					return True;
-		}
-	} else {
-		for (i = 0; i < ntags; i++)
-			if (c->tags[i] && m->seltags[i])
-				return True;
-	}
+	if (m)
+		return tagsintersect(c->tags, &m->seltags);
+	for (m = monitors; m; m = m->next)
+		if (tagsintersect(c->tags, &m->seltags))
+			return True;
+	return False;
+}
+
+void
+tagsclear(Tags * t) {
+	memset(t, 0, sizeof(Tags));
+}
+
+Bool
+tagsempty(Tags * t) {
+	unsigned int i;
+
+	for (i = 0; i < TAGWORDS; i++)
+		if (t->w[i])
+			return False;
+	return True;
+}
+
+void
+tagsfill(Tags * t) {
+	unsigned int i;
+
+	tagsclear(t);
+	for (i = 0; i < ntags; i++)
+		SETTAG(t, i);
+}
+
+Bool
+tagsintersect(Tags * a, Tags * b) {
+	unsigned int i;
+
+	for (i = 0; i < TAGWORDS; i++)
+		if (a->w[i] & b->w[i])
+			return True;
 	return False;
 }
 
@@ -959,7 +1428,7 @@ killclient(const char *arg) {
 
 	if (!sel)
 		return;
-	if (checkatom(sel->win, atom[WMProto], atom[WMDelete])) {
+	if (sel->cold->protocols & ProtoDelete) {
 		ev.type = ClientMessage;
 		ev.xclient.window = sel->win;
 		ev.xclient.message_type = atom[WMProto];
@@ -977,6 +1446,10 @@ leavenotify(XEvent * e) {
 	XCrossingEvent *ev = &e->xcrossing;
 	Client *c;
 
+	/* left before the focus settled */
+	if (ev->detail != NotifyInferior && deref(focuswait) &&
+	    getclient(ev->window, ClientFrame) == deref(focuswait))
+		unsettle();
 	if ((ev->window == root) && !ev->same_screen) {
 		selscreen = False;
 		focus(NULL);
@@ -990,18 +1463,25 @@ manage(Window w, XWindowAttributes * wa) {
 	Window trans;
 	XWindowChanges wc;
 	XSetWindowAttributes twa;
-	XWMHints *wmh;
 	unsigned long mask = 0;
+	Bool fetched;
 
-	c = emallocz(sizeof(Client));
+	/* the properties read below come in one round trip; scan() has
+	 * fetched them already */
+	if (!(fetched = prefetched(w)))
+		prefetch(&w, 1);
+	c = allocclient();
 	c->win = w;
-	if (checkatom(c->win, atom[WindowType], atom[WindowTypeDesk]) ||
-	    checkatom(c->win, atom[WindowType], atom[WindowTypeDock])) {
+	c->wintype = getwintype(c->win);
+	c->cold->protocols = getprotocols(c->win);
+	if (c->cold->protocols & ProtoSyncRequest)
+		c->cold->synccounter = getsynccounter(c->win);
+	if (c->wintype & (TypeDesk | TypeDock)) {
 		c->isbastard = True;
 		c->isfloating = True;
 		c->isfixed = True;
 	}
-	if (checkatom(c->win, atom[WindowType], atom[WindowTypeDialog])) {
+	if (c->wintype & TypeDialog) {
 		c->isfloating = True;
 		c->isfixed = True;
 	}
@@ -1009,21 +1489,23 @@ manage(Window w, XWindowAttributes * wa) {
 	cm = curmonitor();
 	c->isicon = False;
 	c->title = c->isbastard ? (Window) NULL : 1;
-	c->tags = emallocz(ntags * sizeof(cm->seltags[0]));
+	c->tags = &c->tagbits;
 	c->isfocusable = c->isbastard ? False : True;
 	c->border = c->isbastard ? 0 : style.border;
-	c->oldborder = c->isbastard ? 0 : wa->border_width; /* XXX: why? */
+	c->cold->oldborder = c->isbastard ? 0 : wa->border_width; /* XXX: why? */
 	/*  XReparentWindow() unmaps *mapped* windows */
-	c->ignoreunmap = wa->map_state == IsViewable ? 1 : 0;
+	c->cold->ignoreunmap = wa->map_state == IsViewable ? 1 : 0;
 	mwm_process_atom(c);
 	updatesizehints(c);
 
 	updatetitle(c);
+	c->cold->wireframe = options.wireframe;
 	applyrules(c);
 
-	if (XGetTransientForHint(dpy, w, &trans)) {
-		if (t = getclient(trans, clients, ClientWindow)) {
-			memcpy(c->tags, t->tags, ntags * sizeof(cm->seltags[0]));
+	if (gettransient(w, &trans)) {
+		c->cold->transfor = trans;
+		if (t = getclient(trans, ClientWindow)) {
+			*c->tags = *t->tags;
 			c->isfloating = True;
 		}
 	}
@@ -1033,25 +1515,20 @@ manage(Window w, XWindowAttributes * wa) {
 	if (!c->isfloating)
 		c->isfloating = c->isfixed;
 
-	if ((wmh = XGetWMHints(dpy, c->win))) {
-		c->isfocusable = !(wmh->flags & InputHint) || wmh->input;
-		XFree(wmh);
-	}
+	updatewmhints(c);
 
-	c->x = c->rx = wa->x;
-	c->y = c->ry = wa->y;
-	c->w = c->rw = wa->width;
-	c->h = c->rh = wa->height + c->th;
+	c->x = c->cold->rx = wa->x;
+	c->y = c->cold->ry = wa->y;
+	c->w = c->cold->rw = wa->width;
+	c->h = c->cold->rh = wa->height + c->th;
 
 	if (!wa->x && !wa->y && !c->isbastard)
 		place(c);
 
 	cm = c->isbastard ? getmonitor(wa->x, wa->y) : clientmonitor(c);
 	c->hasstruts = getstruts(c); 
-	if (c->isbastard) {
-		free(c->tags);
-		c->tags = cm->seltags;
-	}
+	if (c->isbastard)
+		c->tags = &cm->seltags;
 #if 0
 	if (c->w == cm->sw && c->h == cm->sh) {
 		c->x = 0;
@@ -1095,14 +1572,18 @@ manage(Window w, XWindowAttributes * wa) {
 		c->title = XCreateWindow(dpy, root, 0, 0, c->w, c->th,
 		    0, DefaultDepth(dpy, screen), CopyFromParent,
 		    DefaultVisual(dpy, screen), CWEventMask, &twa);
-		c->drawable =
+		c->cold->drawable =
 		    XCreatePixmap(dpy, root, c->w, c->th, DefaultDepth(dpy, screen));
-		c->xftdraw =
-		    XftDrawCreate(dpy, c->drawable, DefaultVisual(dpy, screen),
+		c->cold->xftdraw =
+		    XftDrawCreate(dpy, c->cold->drawable, DefaultVisual(dpy, screen),
 		    DefaultColormap(dpy, screen));
 	} else {
 		c->title = (Window) NULL;
 	}
+	addwin(c->win, c, ClientWindow);
+	addwin(c->frame, c, ClientFrame);
+	if (c->title)
+		addwin(c->title, c, ClientTitle);
 
 	attach(c);
 	attachstack(c);
@@ -1121,8 +1602,11 @@ manage(Window w, XWindowAttributes * wa) {
 	configure(c);	/* propagates border_width, if size doesn't change */
 	if (checkatom(c->win, atom[WindowState], atom[WindowStateFs]))
 		ewmh_process_state_atom(c, atom[WindowStateFs], 1);
+	if (!fetched)
+		unfetch();
 	ban(c);
-	updateatom[ClientList] (NULL);
+	ewmh_add_client(c->win);
+	updateatom[ClientListStacking] (NULL);
 	updateatom[WindowDesk] (c);
 	updateframe(c);
 	if (!cm)
@@ -1130,7 +1614,7 @@ manage(Window w, XWindowAttributes * wa) {
 	if (c->hasstruts)
 		updategeom(cm);
 	arrange(cm);
-	if (!checkatom(c->win, atom[WindowType], atom[WindowTypeDesk]))
+	if (!(c->wintype & TypeDesk))
 		focus(NULL);
 }
 
@@ -1153,15 +1637,85 @@ maprequest(XEvent * e) {
 		return;
 	if (wa.override_redirect)
 		return;
-	if (!(c = getclient(ev->window, clients, ClientWindow)))
+	if (!(c = getclient(ev->window, ClientWindow)))
 		manage(ev->window, &wa);
 }
 
+void
+markdirty(Monitor * m, int what) {
+	if (m) {
+		m->dirty |= what;
+		return;
+	}
+	for (m = monitors; m; m = m->next)
+		m->dirty |= what;
+}
+
+void
+listappend(ClientArray * l, Client * c) {
+	if (l->n == l->size) {
+		l->size = l->size ? l->size * 2 : 16;
+		l->c = erealloc(l->c, l->size * sizeof(Client *));
+	}
+	l->c[l->n++] = c;
+}
+
+ClientArray *
+monlist(Monitor * m, int which) {
+	ClientArray *head[MAXTAGS], *l;
+	unsigned int pos[MAXTAGS], i, j, k;
+	Client *c;
+
+	if (m->listsvalid)
+		return &m->lists[which];
+	for (i = 0; i < LastList; i++) {
+		for (j = 0; j < m->lists[i].n; j++)
+			m->lists[i].c[j]->inlists &= ~MONBIT(m);
+		m->lists[i].n = 0;
+	}
+	/* merge the viewed tags' members, newest first like the clients
+	 * list; a client on several of them comes up in each */
+	for (i = 0, k = 0; i < ntags; i++)
+		if (ISTAGGED(&m->seltags, i) && taglists[i].n) {
+			head[k] = &taglists[i];
+			pos[k++] = taglists[i].n;
+		}
+	for (;;) {
+		for (c = NULL, j = 0; j < k; j++)
+			if (pos[j] && (!c || head[j]->c[pos[j] - 1]->seq > c->seq))
+				c = head[j]->c[pos[j] - 1];
+		if (!c)
+			break;
+		for (j = 0; j < k; j++)
+			if (pos[j] && head[j]->c[pos[j] - 1] == c)
+				pos[j]--;
+		if (c->isicon)
+			l = &m->lists[IconList];
+		else if (c->isfloating)
+			l = &m->lists[FloatList];
+		else
+			l = &m->lists[TiledList];
+		listappend(l, c);
+		c->inlists |= MONBIT(m);
+	}
+	for (i = bastards.n; i--;)
+		if (isvisible(bastards.c[i], m)) {
+			listappend(&m->lists[BastardList], bastards.c[i]);
+			bastards.c[i]->inlists |= MONBIT(m);
+		}
+	m->listsvalid = True;
+	return &m->lists[which];
+}
+
 void
 monocle(Monitor * m) {
+	ClientArray *l;
 	Client *c;
+	unsigned int i;
 
-	for (c = nexttiled(clients, m); c; c = nexttiled(c->next, m)) {
+	l = monlist(m, TiledList);
+	for (i = 0; i < l->n; i++) {
+			c = l->c[i];
 			if (views[m->curtag].barpos != StrutsOn)
 				resize(c, m->wax - c->border,
 						m->way - c->border, m->waw, m->wah, False);
@@ -1182,10 +1736,10 @@ moveresizekb(const char *arg) {
 	if (!sel->isfloating)
 		return;
 	sscanf(arg, "%d %d %d %d", &dx, &dy, &dw, &dh);
-	if (dw && (dw < sel->incw))
-		dw = (dw / abs(dw)) * sel->incw;
-	if (dh && (dh < sel->inch))
-		dh = (dh / abs(dh)) * sel->inch;
+	if (dw && (dw < sel->cold->incw))
+		dw = (dw / abs(dw)) * sel->cold->incw;
+	if (dh && (dh < sel->cold->inch))
+		dh = (dh / abs(dh)) * sel->cold->inch;
 	resize(sel, sel->x + dx, sel->y + dy, sel->w + dw,
 	    sel->h + dh, True);
 }
@@ -1196,17 +1750,60 @@ getpointer(int *x, int *y) {
 	unsigned int dui;
 	Window dummy;
 
-	XQueryPointer(dpy, root, &dummy, &dummy, x, y, &di, &di, &dui);
+	/* the position is tracked from the events we get anyway, so the
+	 * server is only asked when nothing has been seen yet */
+	if (!ptrvalid)
+		ptrvalid = XQueryPointer(dpy, root, &dummy, &dummy, &ptrx, &ptry,
+		    &di, &di, &dui);
+	*x = ptrx;
+	*y = ptry;
+}
+
+void
+setpointer(int x, int y) {
+	ptrx = x;
+	ptry = y;
+	ptrvalid = True;
+}
+
+void
+trackpointer(XEvent * e) {
+	switch (e->type) {
+	case ButtonPress:
+	case ButtonRelease:
+		if (e->xbutton.same_screen)
+			setpointer(e->xbutton.x_root, e->xbutton.y_root);
+		break;
+	case KeyPress:
+	case KeyRelease:
+		if (e->xkey.same_screen)
+			setpointer(e->xkey.x_root, e->xkey.y_root);
+		break;
+	case MotionNotify:
+		if (e->xmotion.same_screen)
+			setpointer(e->xmotion.x_root, e->xmotion.y_root);
+		break;
+	case EnterNotify:
+	case LeaveNotify:
+		if (e->xcrossing.same_screen)
+			setpointer(e->xcrossing.x_root, e->xcrossing.y_root);
+		break;
+	}
 }
 
 Monitor *
 getmonitor(int x, int y) {
 	Monitor *m;
 
+#define INMONITOR(_m, _x, _y) ((_x) >= (_m)->sx && (_x) <= (_m)->sx + (_m)->sw && \
+			       (_y) >= (_m)->sy && (_y) <= (_m)->sy + (_m)->sh)
+
+	/* the pointer rarely leaves its monitor between two lookups */
+	if (lastmon && INMONITOR(lastmon, x, y))
+		return lastmon;
 	for (m = monitors; m; m = m->next) {
-		if ((x >= m->sx && x <= m->sx + m->sw) &&
-		    (y >= m->sy && y <= m->sy + m->sh))
-			return m;
+		if (INMONITOR(m, x, y))
+			return (lastmon = m);
 	}
 	return NULL;
 }
@@ -1216,10 +1813,15 @@ clientmonitor(Client * c) {
 	Monitor *m;
 
 	assert(c != NULL);
+	/* view changes bump viewgen, client changes reset mongen */
+	if (c->mongen == viewgen)
+		return c->mon;
 	for (m = monitors; m; m = m->next)
 		if (isvisible(c, m))
-			return m;
-	return NULL;
+			break;
+	c->mon = m;
+	c->mongen = viewgen;
+	return m;
 }
 
 Monitor *
@@ -1231,108 +1833,191 @@ curmonitor() {
 
 void
 mousemove(Client * c) {
-	int x1, y1, ocx, ocy, nx, ny;
-	unsigned int i;
-	XEvent ev;
-	Monitor *m, *nm;
-
 	if (c->isbastard)
 		return;
-	m = curmonitor();
-	ocx = c->x;
-	ocy = c->y;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync,
 		GrabModeAsync, None, cursor[CurMove], CurrentTime) != GrabSuccess)
 		return;
-	getpointer(&x1, &y1);
-	for (;;) {
-		XMaskEvent(dpy, MOUSEMASK | ExposureMask | SubstructureRedirectMask, &ev);
-		switch (ev.type) {
-		case ButtonRelease:
-			XUngrabPointer(dpy, CurrentTime);
-			return;
-		case ConfigureRequest:
-		case Expose:
-		case MapRequest:
-			handler[ev.type] (&ev);
-			break;
-		case MotionNotify:
-			XSync(dpy, False);
-			/* we are probably moving to a different monitor */
-			if (!(nm = curmonitor()))
-				break;
-			nx = ocx + (ev.xmotion.x_root - x1);
-			ny = ocy + (ev.xmotion.y_root - y1);
-			if (abs(nx - nm->wax) < options.snap)
-				nx = nm->wax;
-			else if (abs((nm->wax + nm->waw) - (nx + c->w +
-				    2 * c->border)) < options.snap)
-				nx = nm->wax + nm->waw - c->w - 2 * c->border;
-			if (abs(ny - nm->way) < options.snap)
-				ny = nm->way;
-			else if (abs((nm->way + nm->wah) - (ny + c->h +
-				    2 * c->border)) < options.snap)
-				ny = nm->way + nm->wah - c->h - 2 * c->border;
-			resize(c, nx, ny, c->w, c->h, True);
-			save(c);
-			if (m != nm) {
-				for (i = 0; i < ntags; i++)
-					c->tags[i] = nm->seltags[i];
-				updateatom[WindowDesk] (c);
-				drawclient(c);
-				arrange(NULL);
-				m = nm;
-			}
-			break;
-		}
-	}
+	drag.c = c;
+	drag.op = DragMove;
+	drag.m = curmonitor();
+	drag.ocx = c->x;
+	drag.ocy = c->y;
+	drag.drawn = drag.pending = False;
+	drag.due = 0;
+	getpointer(&drag.x1, &drag.y1);
 }
 
 void
 mouseresize(Client * c) {
-	int ocx, ocy, nw, nh;
-	Monitor *cm;
-	XEvent ev;
-
 	if (c->isbastard || c->isfixed)
 		return;
-	cm = curmonitor();
-
-	ocx = c->x;
-	ocy = c->y;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync,
 		GrabModeAsync, None, cursor[CurResize], CurrentTime) != GrabSuccess)
 		return;
 	c->ismax = False;
 	XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, c->w + c->border - 1,
 	    c->h + c->border - 1);
-	for (;;) {
-		XMaskEvent(dpy, MOUSEMASK | ExposureMask | SubstructureRedirectMask, &ev);
-		switch (ev.type) {
-		case ButtonRelease:
-			XWarpPointer(dpy, None, c->win, 0, 0, 0, 0,
-			    c->w + c->border - 1, c->h + c->border - 1);
-			XUngrabPointer(dpy, CurrentTime);
-			while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
-			return;
-		case ConfigureRequest:
-		case Expose:
-		case MapRequest:
-			handler[ev.type] (&ev);
-			break;
-		case MotionNotify:
-			XSync(dpy, False);
-			if ((nw = ev.xmotion.x - ocx - 2 * c->border + 1) <= 0)
-				nw = MINWIDTH;
-			if ((nh = ev.xmotion.y - ocy - 2 * c->border + 1) <= 0)
-				nh = MINHEIGHT;
-			resize(c, c->x, c->y, nw, nh, True);
-			save(c);
-			break;
+	drag.c = c;
+	drag.op = DragResize;
+	drag.m = curmonitor();
+	drag.ocx = c->x;
+	drag.ocy = c->y;
+	drag.drawn = drag.pending = False;
+	drag.due = 0;
+}
+
+void
+motionnotify(XEvent * e) {
+	XEvent ev;
+
+	if (!drag.c)
+		return;
+	/* only the latest position matters */
+	while (XCheckTypedEvent(dpy, MotionNotify, &ev))
+		trackpointer(&ev);
+	drag.pending = True;
+	dragupdate(False);
+}
+
+/* commits the pointer position to the dragged client, at most once a
+ * frame unless final is set; run() calls back when the next one is due */
+void
+dragupdate(Bool final) {
+	Client *c = drag.c;
+	Monitor *m;
+	int x, y, w, h;
+
+	if (!c || !drag.pending)
+		return;
+	if (!final && msnow() < drag.due) {
+		settimer(dragtick, NULL, drag.due - msnow());
+		return;
+	}
+	/* not before the client has drawn the last size: syncalarm() or
+	 * the timeout brings us back */
+	if (!final && drag.op == DragResize && !c->cold->wireframe && syncpending(c)) {
+		settimer(dragtick, NULL, c->cold->syncdue - msnow());
+		return;
+	}
+	drag.pending = False;
+	/* we are probably moving to a different monitor */
+	if (!(m = curmonitor()))
+		return;
+	drag.due = msnow() + framedelay(m);
+	getpointer(&x, &y);
+	if (drag.op == DragMove) {
+		x = drag.ocx + (x - drag.x1);
+		y = drag.ocy + (y - drag.y1);
+		w = c->w;
+		h = c->h;
+		if (abs(x - m->wax) < options.snap)
+			x = m->wax;
+		else if (abs((m->wax + m->waw) - (x + w +
+			    2 * c->border)) < options.snap)
+			x = m->wax + m->waw - w - 2 * c->border;
+		if (abs(y - m->way) < options.snap)
+			y = m->way;
+		else if (abs((m->way + m->wah) - (y + h +
+			    2 * c->border)) < options.snap)
+			y = m->way + m->wah - h - 2 * c->border;
+	} else {
+		if ((w = x - drag.ocx - 2 * c->border + 1) <= 0)
+			w = MINWIDTH;
+		if ((h = y - drag.ocy - 2 * c->border + 1) <= 0)
+			h = MINHEIGHT;
+		x = c->x;
+		y = c->y;
+	}
+	if (c->cold->wireframe) {
+		/* the outline shows what will be committed */
+		if (drag.op == DragResize)
+			applysizehints(c, &w, &h);
+		drag.ox = x;
+		drag.oy = y;
+		drag.ow = w;
+		drag.oh = h;
+		drawoutline(c, x, y, w, h);
+		drag.drawn = True;
+	} else {
+		resize(c, x, y, w, h, True);
+		save(c);
+	}
+}
+
+void
+dragtick(void *arg) {
+	dragupdate(False);
+}
+
+void
+syncalarm(XEvent * e) {
+	Client *c;
+
+	if ((c = syncdone(e)) && c == drag.c)
+		dragupdate(False);
+}
+
+void
+dragend(void) {
+	Client *c = drag.c;
+	Monitor *m;
+
+	drag.pending = True;
+	dragupdate(True);
+	if (c->cold->wireframe && drag.drawn) {
+		hideoutline();
+		/* the size hints were applied to the outline already */
+		resize(c, drag.ox, drag.oy, drag.ow, drag.oh, False);
+		save(c);
+	}
+	drag.c = NULL;
+	drag.drawn = drag.pending = False;
+	deltimer(dragtick, NULL);
+	if (drag.op == DragMove) {
+		XUngrabPointer(dpy, CurrentTime);
+		/* retag once the window is dropped, not on every crossing */
+		if ((m = curmonitor()) && m != drag.m) {
+			*c->tags = m->seltags;
+			invalidateclient(c);
+			updateatom[WindowDesk] (c);
+			drawclient(c);
+			arrange(NULL);
 		}
+	} else {
+		XWarpPointer(dpy, None, c->win, 0, 0, 0, 0,
+		    c->w + c->border - 1, c->h + c->border - 1);
+		setpointer(c->x + c->border + c->w + c->border - 1,
+		    c->y + c->border + c->th + c->h + c->border - 1);
+		XUngrabPointer(dpy, CurrentTime);
+		ignoreenter();
 	}
 }
 
+/* the client went away in the middle of a drag */
+void
+dragcancel(void) {
+	if (drag.drawn)
+		hideoutline();
+	XUngrabPointer(dpy, CurrentTime);
+	drag.c = NULL;
+	drag.drawn = drag.pending = False;
+	deltimer(dragtick, NULL);
+}
+
+long
+msnow(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int
+framedelay(Monitor * m) {
+	return 1000 / (m && m->refresh > 0 ? m->refresh : REFRESH);
+}
+
 Client *
 nexttiled(Client * c, Monitor * m) {
 	for (; c && (c->isfloating || !isvisible(c, m) || c->isbastard
@@ -1352,7 +2037,7 @@ reparentnotify(XEvent * e) {
 	Client *c;
 	XReparentEvent *ev = &e->xreparent;
 
-	if ((c = getclient(ev->window, clients, ClientWindow)))
+	if ((c = getclient(ev->window, ClientWindow)))
 		if (ev->parent != c->frame)
 			unmanage(c);
 }
@@ -1382,8 +2067,8 @@ place(Client *c) {
 		y = m->way + m->wah - c->h - rand()%d;
 	DPRINTF("%d %d\n", x, y);
 
-	c->rx = c->x = x;
-	c->ry = c->y = y;
+	c->cold->rx = c->x = x;
+	c->cold->ry = c->y = y;
 }
 
 void
@@ -1392,12 +2077,35 @@ propertynotify(XEvent * e) {
 	Window trans;
 	XPropertyEvent *ev = &e->xproperty;
 
-	if ((c = getclient(ev->window, clients, ClientWindow))) {
+	if ((c = getclient(ev->window, ClientWindow))) {
+		/* clients and other tools write WM_STATE, _NET_WM_STATE and
+		 * friends too, so the write cache can't vouch for them */
+		forgetprop(c->win, ev->atom);
 		if (ev->atom == atom[StrutPartial]) {
 			c->hasstruts = getstruts(c);
 			updategeom(clientmonitor(c));
 			arrange(clientmonitor(c));
 		}
+		/* keep the per-client property cache in sync */
+		if (ev->atom == atom[WMProto]) {
+			c->cold->protocols = getprotocols(c->win);
+			if (!(c->cold->protocols & ProtoSyncRequest) && c->cold->synccounter) {
+				syncfree(c);
+				c->cold->synccounter = None;
+			} else if ((c->cold->protocols & ProtoSyncRequest) && !c->cold->synccounter)
+				c->cold->synccounter = getsynccounter(c->win);
+		} else if (ev->atom == atom[WMSyncCounter]) {
+			syncfree(c);
+			c->cold->synccounter = (c->cold->protocols & ProtoSyncRequest) ?
+			    getsynccounter(c->win) : None;
+		}
+		else if (ev->atom == atom[WindowType])
+			c->wintype = getwintype(c->win);
+		else if (ev->atom == XA_WM_HINTS)
+			updatewmhints(c);
+		else if (ev->atom == XA_WM_TRANSIENT_FOR)
+			c->cold->transfor = gettransient(c->win, &trans) ?
+			    trans : None;
 		if (ev->state == PropertyDelete) 
 			return;
 		if (ev->atom == atom[WindowName]) {
@@ -1406,11 +2114,12 @@ propertynotify(XEvent * e) {
 		}
 		switch (ev->atom) {
 		case XA_WM_TRANSIENT_FOR:
-			XGetTransientForHint(dpy, c->win, &trans);
 			if (!c->isfloating
 			    && (c->isfloating =
-				(getclient(trans, clients, ClientWindow) != NULL)))
+				(getclient(c->cold->transfor, ClientWindow) != NULL))) {
+				invalidateclient(c);
 				arrange(clientmonitor(c));
+			}
 			break;
 		case XA_WM_NORMAL_HINTS:
 			updatesizehints(c);
@@ -1433,50 +2142,58 @@ quit(const char *arg) {
 	}
 }
 
+/* adjusts a frame size to the client's WM_NORMAL_HINTS */
 void
-resize(Client * c, int x, int y, int w, int h, Bool sizehints) {
-	XWindowChanges wc;
+applysizehints(Client * c, int *w, int *h) {
+	ClientCold *cc = c->cold;
 
-	if (sizehints) {
-		h -= c->th;
-		/* set minimum possible */
-		if (w < 1)
-			w = 1;
-		if (h < 1)
-			h = 1;
-
-		/* temporarily remove base dimensions */
-		w -= c->basew;
-		h -= c->baseh;
-
-		/* adjust for aspect limits */
-		if (c->minay > 0 && c->maxay > 0 && c->minax > 0 && c->maxax > 0) {
-			if (w * c->maxay > h * c->maxax)
-				w = h * c->maxax / c->maxay;
-			else if (w * c->minay < h * c->minax)
-				h = w * c->minay / c->minax;
-		}
+	*h -= c->th;
+	/* set minimum possible */
+	if (*w < 1)
+		*w = 1;
+	if (*h < 1)
+		*h = 1;
+
+	/* temporarily remove base dimensions */
+	*w -= cc->basew;
+	*h -= cc->baseh;
 
-		/* adjust for increment value */
-		if (c->incw)
-			w -= w % c->incw;
-		if (c->inch)
-			h -= h % c->inch;
-
-		/* restore base dimensions */
-		w += c->basew;
-		h += c->baseh;
-
-		if (c->minw > 0 && w < c->minw)
-			w = c->minw;
-		if (c->minh > 0 && h - c->th < c->minh)
-			h = c->minh + c->th;
-		if (c->maxw > 0 && w > c->maxw)
-			w = c->maxw;
-		if (c->maxh > 0 && h - c->th > c->maxh)
-			h = c->maxh + c->th;
-		h += c->th;
+	/* adjust for aspect limits */
+	if (cc->minay > 0 && cc->maxay > 0 && cc->minax > 0 && cc->maxax > 0) {
+		if (*w * cc->maxay > *h * cc->maxax)
+			*w = *h * cc->maxax / cc->maxay;
+		else if (*w * cc->minay < *h * cc->minax)
+			*h = *w * cc->minay / cc->minax;
 	}
+
+	/* adjust for increment value */
+	if (cc->incw)
+		*w -= *w % cc->incw;
+	if (cc->inch)
+		*h -= *h % cc->inch;
+
+	/* restore base dimensions */
+	*w += cc->basew;
+	*h += cc->baseh;
+
+	if (cc->minw > 0 && *w < cc->minw)
+		*w = cc->minw;
+	if (cc->minh > 0 && *h - c->th < cc->minh)
+		*h = cc->minh + c->th;
+	if (cc->maxw > 0 && *w > cc->maxw)
+		*w = cc->maxw;
+	if (cc->maxh > 0 && *h - c->th > cc->maxh)
+		*h = cc->maxh + c->th;
+	*h += c->th;
+}
+
+void
+resize(Client * c, int x, int y, int w, int h, Bool sizehints) {
+	XWindowChanges wc;
+	Bool redraw = False;
+
+	if (sizehints)
+		applysizehints(c, &w, &h);
 	if (w <= 0 || h <= 0)
 		return;
 	/* offscreen appearance fixes */
@@ -1486,12 +2203,15 @@ resize(Client * c, int x, int y, int w, int h, Bool sizehints) {
 		y = DisplayHeight(dpy, screen) - h - 2 * c->border;
 	if (w != c->w && c->th) {
 		XMoveResizeWindow(dpy, c->title, 0, 0, w, c->th);
-		XFreePixmap(dpy, c->drawable);
-		c->drawable =
+		XFreePixmap(dpy, c->cold->drawable);
+		c->cold->drawable =
 			XCreatePixmap(dpy, root, w, c->th, DefaultDepth(dpy, screen));
-		drawclient(c);
+		redraw = True;
 	}
 	if (c->x != x || c->y != y || c->w != w || c->h != h /* || sizehints */) {
+		/* the request has to reach the client before the configure */
+		if (c->w != w || c->h != h)
+			syncrequest(c);
 		c->x = x;
 		c->y = y;
 		c->w = w;
@@ -1500,112 +2220,256 @@ resize(Client * c, int x, int y, int w, int h, Bool sizehints) {
 		XMoveResizeWindow(dpy, c->frame, c->x, c->y, c->w, c->h);
 		XMoveResizeWindow(dpy, c->win, 0, c->th, c->w, c->h - c->th);
 		configure(c);
-		XSync(dpy, False);
 	}
+	/* after c->w, the title is drawn for the new width */
+	if (redraw)
+		drawclient(c);
+}
+
+int
+clientlayer(Client * c) {
+	if (c->isbastard)
+		return (c->wintype & TypeDesk) ? LayerDesk : LayerDock;
+	return c->isfloating ? LayerFloat : LayerTiled;
 }
 
 void
 restack(Monitor * m) {
+	static Window *layer[LastLayer], *wl;
+	static unsigned int size;
+	unsigned int n[LastLayer] = { 0 }, i, l, p, s, total;
 	Client *c;
-	XEvent ev;
-	Window *wl;
-	int i, n;
 
 	if (!sel)
 		return;
-#if 0
-	if (MFEATURES(m, OVERLAP)) {
-		XRaiseWindow(dpy, stack->frame);
-		goto end;
-	}
-#endif
-	for (n = 0, c = stack; c; c = c->snext) {
-		if (isvisible(c, m) && !c->isicon) {
-			n++;
+	/* one pass down the focus stack, sorting frames into their layers */
+	for (c = stack; c; c = c->snext) {
+		if (!isvisible(c, m) || c->isicon)
+			continue;
+		l = clientlayer(c);
+		if (n[l] == size) {
+			size = size ? size * 2 : 32;
+			for (i = 0; i < LastLayer; i++)
+				layer[i] = erealloc(layer[i], size * sizeof(Window));
+			wl = erealloc(wl, LastLayer * size * sizeof(Window));
 		}
+		layer[l][n[l]++] = c->frame;
+	}
+	for (total = 0, l = 0; l < LastLayer; l++) {
+		memcpy(wl + total, layer[l], n[l] * sizeof(Window));
+		total += n[l];
 	}
-	if (!n)
+	/* compare with what the server was told last time */
+	for (p = 0; p < total && p < m->norder && wl[p] == m->order[p]; p++);
+	if (p == total && p == m->norder)
 		return;
-	wl = malloc(sizeof(Window) * n);
-	i = 0;
-	for (c = stack; c && i < n; c = c->snext)
-		if (isvisible(c, m) && !c->isicon && c->isbastard &&
-		    !checkatom(c->win, atom[WindowType], atom[WindowTypeDesk]))
-			wl[i++] = c->frame;
-	for (c = stack; c && i < n; c = c->snext)
-		if (isvisible(c, m) && !c->isicon) {
-			if (!c->isbastard && c->isfloating)
-				wl[i++] = c->frame;
-		}
-	for (c = stack; c && i < n; c = c->snext) 
-		if (isvisible(c, m) && !c->isicon)
-			if (!c->isfloating && !c->isbastard)
-				wl[i++] = c->frame;
-	for (c = stack; c && i < n; c = c->snext)
-		if (isvisible(c, m) && !c->isicon && c->isbastard && 
-			checkatom(c->win, atom[WindowType], atom[WindowTypeDesk]))
-				wl[i++] = c->frame;
-	assert(i == n);
-	XRestackWindows(dpy, wl, n);
-	free(wl);
-      end:
-	XSync(dpy, False);
-	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+	for (s = 0; s < total - p && s < m->norder - p &&
+	    wl[total - 1 - s] == m->order[m->norder - 1 - s]; s++);
+	if (total > m->sorder) {
+		m->sorder = total;
+		m->order = erealloc(m->order, m->sorder * sizeof(Window));
+	}
+	memcpy(m->order, wl, total * sizeof(Window));
+	m->norder = total;
+	/* the frames above the first change and below the last one keep
+	 * their places, the ones in between go under the last one above */
+	if (p && total - s - p + 1 > 1)
+		XRestackWindows(dpy, wl + p - 1, total - s - p + 1);
+	else if (!p && total > 1)
+		XRestackWindows(dpy, wl, total);
+	updateatom[ClientListStacking] (NULL);
 }
 
 void
 run(void) {
-	fd_set rd;
-	int xfd;
 	XEvent ev;
+	int i, n;
 
 	/* main event loop */
 	XSync(dpy, False);
-	xfd = ConnectionNumber(dpy);
+	watchfd(ConnectionNumber(dpy), NULL);	/* read by XPending() */
 	while (running) {
-		FD_ZERO(&rd);
-		FD_SET(xfd, &rd);
-		if (select(xfd + 1, &rd, NULL, NULL, NULL) == -1) {
-			if (errno == EINTR)
-				continue;
-			eprint("select failed\n");
-		}
 		while (XPending(dpy)) {
 			XNextEvent(dpy, &ev);
-			if (handler[ev.type])
+			trackpointer(&ev);
+			if (syncevent && ev.type == syncevent)
+				syncalarm(&ev);
+			else if (handler[ev.type])
 				(handler[ev.type]) (&ev);	/* call handler */
 		}
+		/* arranging may have queued new events, look again first */
+		if (arrangedirty())
+			continue;
+		/* and so may timers */
+		if (runtimers())
+			continue;
+		if ((n = poll(watches, nwatches, nexttimer())) == -1) {
+			if (errno == EINTR)
+				continue;
+			eprint("poll failed\n");
+		}
+		for (i = 0; n > 0 && i < nwatches; i++) {
+			if (!watches[i].revents)
+				continue;
+			n--;
+			if (watchfuncs[i])
+				watchfuncs[i] (watches[i].fd);
+		}
+	}
+}
+
+/* Timers call func(arg) once, ms milliseconds from now.  A func and arg
+ * pair is set at most once: setting it again moves it. */
+void
+settimer(void (*func) (void *arg), void *arg, long ms) {
+	Timer *t, **tp;
+
+	deltimer(func, arg);
+	t = emallocz(sizeof(Timer));
+	t->due = msnow() + ms;
+	t->func = func;
+	t->arg = arg;
+	for (tp = &timers; *tp && (*tp)->due <= t->due; tp = &(*tp)->next);
+	t->next = *tp;
+	*tp = t;
+}
+
+void
+deltimer(void (*func) (void *arg), void *arg) {
+	Timer *t, **tp;
+
+	for (tp = &timers; (t = *tp); tp = &t->next)
+		if (t->func == func && t->arg == arg) {
+			*tp = t->next;
+			free(t);
+			return;
+		}
+}
+
+/* returns whether any timer was due */
+Bool
+runtimers(void) {
+	Timer *t;
+	void (*func) (void *arg);
+	void *arg;
+	long now = msnow();
+	Bool ran = False;
+
+	while ((t = timers) && t->due <= now) {
+		timers = t->next;
+		func = t->func;
+		arg = t->arg;
+		free(t);
+		func(arg);
+		ran = True;
 	}
+	return ran;
+}
+
+/* milliseconds until the next timer, -1 if there is none */
+int
+nexttimer(void) {
+	long ms;
+
+	if (!timers)
+		return -1;
+	ms = timers->due - msnow();
+	return ms < 0 ? 0 : ms > INT_MAX ? INT_MAX : ms;
+}
+
+/* run() calls func(fd) when fd becomes readable */
+void
+watchfd(int fd, void (*func) (int fd)) {
+	if (nwatches == swatches) {
+		swatches = swatches ? swatches * 2 : 4;
+		watches = erealloc(watches, swatches * sizeof(struct pollfd));
+		watchfuncs = erealloc(watchfuncs, swatches * sizeof(*watchfuncs));
+	}
+	watches[nwatches].fd = fd;
+	watches[nwatches].events = POLLIN;
+	watches[nwatches].revents = 0;
+	watchfuncs[nwatches++] = func;
+}
+
+void
+unwatchfd(int fd) {
+	int i;
+
+	for (i = 0; i < nwatches && watches[i].fd != fd; i++);
+	if (i == nwatches)
+		return;
+	nwatches--;
+	memmove(watches + i, watches + i + 1, (nwatches - i) * sizeof(struct pollfd));
+	memmove(watchfuncs + i, watchfuncs + i + 1, (nwatches - i) * sizeof(*watchfuncs));
 }
 
 void
 scan(void) {
-	unsigned int i, num;
-	Window *wins, d1, d2;
-	XWindowAttributes wa;
-
-	wins = NULL;
-	if (XQueryTree(dpy, root, &d1, &d2, &wins, &num)) {
-		for (i = 0; i < num; i++) {
-			if (!XGetWindowAttributes(dpy, wins[i], &wa) ||
-			    wa.override_redirect
-			    || XGetTransientForHint(dpy, wins[i], &d1))
-				continue;
-			if (wa.map_state == IsViewable
-			    || getstate(wins[i]) == IconicState
-			    || getstate(wins[i]) == NormalState)
-				manage(wins[i], &wa);
+	unsigned int i, n, num;
+	long state;
+#ifdef DEBUG
+	long t0, t1;
+#endif
+	Window *wins, *fetch, d1, d2;
+	struct {
+		XWindowAttributes wa;
+		Bool manage, transient;
+	} *snap;
+
+	/* take a consistent snapshot of the tree and everything we need
+	 * to know about it, asking for each property only once */
+#ifdef DEBUG
+	t0 = msnow();
+#endif
+	XGrabServer(dpy);
+	if (!XQueryTree(dpy, root, &d1, &d2, &wins, &num)) {
+		XUngrabServer(dpy);
+		return;
+	}
+	snap = emallocz((num ? num : 1) * sizeof(*snap));
+	fetch = emallocz((num ? num : 1) * sizeof(Window));
+	for (i = 0, n = 0; i < num; i++)
+		if (XGetWindowAttributes(dpy, wins[i], &snap[i].wa) &&
+		    !snap[i].wa.override_redirect) {
+			snap[i].manage = True;
+			fetch[n++] = wins[i];
 		}
-		for (i = 0; i < num; i++) {	/* now the transients */
-			if (!XGetWindowAttributes(dpy, wins[i], &wa))
+	/* the properties manage() reads, of all of them in one round trip */
+	prefetch(fetch, n);
+	for (i = 0; i < num; i++) {
+		if (!snap[i].manage)
+			continue;
+		if (snap[i].wa.map_state != IsViewable) {
+			state = getstate(wins[i]);
+			if (state != IconicState && state != NormalState) {
+				snap[i].manage = False;
 				continue;
-			if (XGetTransientForHint(dpy, wins[i], &d1)
-			    && (wa.map_state == IsViewable
-				|| getstate(wins[i]) == IconicState
-				|| getstate(wins[i]) == NormalState))
-				manage(wins[i], &wa);
+			}
 		}
+		snap[i].transient = gettransient(wins[i], &d1);
 	}
+	XUngrabServer(dpy);
+#ifdef DEBUG
+	t1 = msnow();
+	DPRINTF("%u windows queried in %ld ms\n", num, t1 - t0);
+#endif
+
+	/* a window gone or changed since is dealt with like any other:
+	 * manage() fails quietly through xerror(), events bring the rest;
+	 * bottom to top, transients after the windows they belong to; the
+	 * layout is applied once, when run() gets to it */
+	for (i = 0; i < num; i++)
+		if (snap[i].manage && !snap[i].transient)
+			manage(wins[i], &snap[i].wa);
+	for (i = 0; i < num; i++)
+		if (snap[i].manage && snap[i].transient)
+			manage(wins[i], &snap[i].wa);
+	unfetch();
+#ifdef DEBUG
+	DPRINTF("windows managed in %ld ms\n", msnow() - t1);
+#endif
+	free(fetch);
+	free(snap);
 	if (wins)
 		XFree(wins);
 }
@@ -1615,15 +2479,17 @@ setclientstate(Client * c, long state) {
 	long data[] = { state, None };
 	long winstate[2];
 
-	XChangeProperty(dpy, c->win, atom[WMState], atom[WMState], 32,
-	    PropModeReplace, (unsigned char *) data, 2);
+	setprop(c->win, atom[WMState], atom[WMState], 32, PropModeReplace,
+	    data, 2);
 	if (state == NormalState) {
+		if (c->isicon)
+			invalidateclient(c);
 		c->isicon = False;
-		XDeleteProperty(dpy, c->win, atom[WindowState]);
+		delprop(c->win, atom[WindowState]);
 	} else {
 		winstate[0] = atom[WindowStateHidden];
-		XChangeProperty(dpy, c->win, atom[WindowState], XA_ATOM, 32,
-		    PropModeReplace, (unsigned char *) winstate, 1);
+		setprop(c->win, atom[WindowState], XA_ATOM, 32,
+		    PropModeReplace, winstate, 1);
 	}
 }
 
@@ -1715,24 +2581,31 @@ initmonitors(XEvent * e) {
 	Monitor *m;
 #ifdef XRANDR
 	Monitor *t;
+	Client *p;
 	XRRCrtcInfo *ci;
 	XRRScreenResources *sr;
-	int c, n;
+	int c, n, i;
 	int ncrtc = 0;
 	int dummy1, dummy2, major, minor;
 
+	/* the drag refers to a monitor about to be freed */
+	if (drag.c)
+		dragcancel();
 	/* free */
 	if (monitors) {
 		m = monitors;
 		do {
 			t = m->next;
-			free(m->seltags);
-			free(m->prevtags);
+			for (c = 0; c < LastList; c++)
+				free(m->lists[c].c);
+			free(m->order);
 			free(m);
 			m = t;
 		} while (m);
-		monitors = NULL;
+		monitors = lastmon = NULL;
 	}
+	for (p = clients; p; p = p->next)
+		p->inlists = 0;
 	if (!running)
 	    return;
 	/* initial Xrandr setup */
@@ -1747,6 +2620,9 @@ initmonitors(XEvent * e) {
 	else
 		ncrtc = sr->ncrtc;
 
+	/* one Client.inlists bit per monitor */
+	if (ncrtc > (int)MAXMONS)
+		ncrtc = (int)MAXMONS;
 	for (c = 0, n = 0, ci = NULL; c < ncrtc; c++) {
 		ci = XRRGetCrtcInfo(dpy, sr, sr->crtcs[c]);
 		if (ci->noutput == 0)
@@ -1763,10 +2639,14 @@ initmonitors(XEvent * e) {
 			m->sy = m->way = ci->y;
 			m->sw = m->waw = ci->width;
 			m->sh = m->wah = ci->height;
+			for (i = 0; i < sr->nmode; i++)
+				if (sr->modes[i].id == ci->mode &&
+				    sr->modes[i].hTotal && sr->modes[i].vTotal)
+					m->refresh = sr->modes[i].dotClock /
+					    (sr->modes[i].hTotal * sr->modes[i].vTotal);
+			m->num = n;
 			m->curtag = n;
-			m->prevtags = emallocz(ntags * sizeof(Bool));
-			m->seltags = emallocz(ntags * sizeof(Bool));
-			m->seltags[n] = True;
+			SETTAG(&m->seltags, n);
 			m->next = monitors;
 			monitors = m;
 			n++;
@@ -1774,6 +2654,8 @@ initmonitors(XEvent * e) {
 		XRRFreeCrtcInfo(ci);
 	}
 	XRRFreeScreenResources(sr);
+	lastmon = NULL;
+	invalidatelists(NULL);
 	updateatom[WorkArea](NULL);
 	return;
       no_xrandr:
@@ -1784,36 +2666,98 @@ initmonitors(XEvent * e) {
 	m->sw = m->waw = DisplayWidth(dpy, screen);
 	m->sh = m->wah = DisplayHeight(dpy, screen);
 	m->curtag = 0;
-	m->prevtags = emallocz(ntags * sizeof(Bool));
-	m->seltags = emallocz(ntags * sizeof(Bool));
-	m->seltags[0] = True;
+	SETTAG(&m->seltags, 0);
 	m->next = NULL;
 	monitors = m;
+	lastmon = NULL;
+	invalidatelists(NULL);
 	updateatom[WorkArea](NULL);;
 }
 
 void
 inittags() {
-	unsigned int i;
+	unsigned int i, h;
 	char tmp[25] = "\0";
 
 	ntags = atoi(getresource("tags.number", "5"));
+	if (ntags < 1)
+		ntags = 1;
+	else if (ntags > MAXTAGS) {
+		fprintf(stderr, "echinus: tags.number %u exceeds %d, rebuild "
+		    "with a larger -DMAXTAGS for more\n", ntags, MAXTAGS);
+		ntags = MAXTAGS;
+	}
 	views = emallocz(ntags * sizeof(View));
+	taglists = emallocz(ntags * sizeof(ClientArray));
 	tags = emallocz(ntags * sizeof(char *));
+	for (ntagtab = 4; ntagtab < 2 * ntags; ntagtab *= 2);
+	tagtab = emallocz(ntagtab * sizeof(int));
 	for (i = 0; i < ntags; i++) {
 		tags[i] = emallocz(25);
 		snprintf(tmp, sizeof(tmp), "tags.name%d", i);
 		snprintf(tags[i], sizeof(tags[i]), "%s", getresource(tmp,
 		    "null"));
+		/* first tag wins on duplicate names, as with a linear search */
+		for (h = taghash(tags[i]); tagtab[h]; h = (h + 1) & (ntagtab - 1))
+			if (!strcmp(tags[i], tags[tagtab[h] - 1]))
+				break;
+		if (!tagtab[h])
+			tagtab[h] = i + 1;
 	}
 }
 
 void
 sighandler(int signum) {
-	if (signum == SIGHUP)
-		quit("HUP!");
-	else
-		quit(NULL);
+	int e = errno;
+	char sig = signum;
+
+	/* the main loop takes it from here, see readsignals() */
+	write(sigpipe[1], &sig, 1);
+	errno = e;
+}
+
+void
+readsignals(int fd) {
+	char sig;
+
+	while (read(fd, &sig, 1) == 1) {
+		switch (sig) {
+		case SIGCHLD:
+			while (waitpid(-1, NULL, WNOHANG) > 0)
+				nchildren--;
+			break;
+		case SIGHUP:
+			quit("HUP!");
+			break;
+		case SIGUSR1:
+			propreport();
+			break;
+		default:
+			quit(NULL);
+			break;
+		}
+	}
+}
+
+void
+initsignals(void) {
+	struct sigaction sa;
+	int sigs[] = { SIGHUP, SIGINT, SIGQUIT, SIGCHLD, SIGUSR1 };
+	unsigned int i;
+
+	if (pipe(sigpipe) == -1)
+		eprint("echinus: cannot create pipe: %s\n", strerror(errno));
+	for (i = 0; i < 2; i++) {
+		fcntl(sigpipe[i], F_SETFD, FD_CLOEXEC);
+		fcntl(sigpipe[i], F_SETFL, fcntl(sigpipe[i], F_GETFL) | O_NONBLOCK);
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sighandler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	for (i = 0; i < LENGTH(sigs); i++)
+		sigaction(sigs[i], &sa, NULL);
+	watchfd(sigpipe[0], readsignals);
 }
 
 void
@@ -1850,10 +2794,11 @@ setup(char *conf) {
 		}
 	XFreeModifiermap(modmap);
 
-	/* select for events */
+	/* select for events; motion over the bare root keeps the cached
+	 * pointer position current, frames report it everywhere else */
 	wa.event_mask = SubstructureRedirectMask | SubstructureNotifyMask
 	    | EnterWindowMask | LeaveWindowMask | StructureNotifyMask |
-	    ButtonPressMask | ButtonReleaseMask;
+	    ButtonPressMask | ButtonReleaseMask | PointerMotionMask;
 	wa.cursor = cursor[CurNormal];
 	XChangeWindowAttributes(dpy, root, CWEventMask | CWCursor, &wa);
 	XSelectInput(dpy, root, wa.event_mask);
@@ -1908,7 +2853,10 @@ setup(char *conf) {
 	options.command[LENGTH(options.command) - 1] = '\0';
 	options.dectiled = atoi(getresource("decoratetiled", STR(DECORATETILED)));
 	options.hidebastards = atoi(getresource("hidebastards", "0"));
+	options.grabarrange = atoi(getresource("grabarrange", "0"));
+	options.wireframe = atoi(getresource("wireframe", "0"));
 	options.focus = atoi(getresource("sloppy", "0"));
+	options.focusdelay = atoi(getresource("focusdelay", "0"));
 	options.snap = atoi(getresource("snap", STR(SNAP)));
 
 	for (m = monitors; m; m = m->next) {
@@ -1920,40 +2868,67 @@ setup(char *conf) {
 	chdir(oldcwd);
 
 	/* multihead support */
-	selscreen = XQueryPointer(dpy, root, &w, &w, &d, &d, &d, &d, &mask);
+	selscreen = XQueryPointer(dpy, root, &w, &w, &ptrx, &ptry, &d, &d, &mask);
+	ptrvalid = selscreen;
 }
 
 void
 spawn(const char *arg) {
-	static char shell[] = "/bin/sh";
+	static char shell[] = "/bin/sh", sarg[] = "-c";
+	char *argv[] = { shell, sarg, NULL, NULL };
+	pid_t pid;
+#ifdef POSIX_SPAWN_SETSID
+	posix_spawnattr_t attr;
+	int err;
+#endif
+#ifdef DEBUG
+	long t = msnow();
+#endif
 
 	if (!arg)
 		return;
-	/* The double-fork construct avoids zombie processes and keeps the code
-	 * clean from stupid signal handlers. */
-	if (fork() == 0) {
-		if (fork() == 0) {
-			if (dpy)
-				close(ConnectionNumber(dpy));
-			setsid();
-			execl(shell, shell, "-c", arg, (char *) NULL);
-			fprintf(stderr, "echinus: execl '%s -c %s'", shell, arg);
-			perror(" failed");
-		}
-		exit(0);
+	argv[2] = (char *) arg;
+	/* no copy of the whole window manager and no waiting for it: the
+	 * X connection is close-on-exec and readsignals() reaps the child */
+#ifdef POSIX_SPAWN_SETSID
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+	err = posix_spawn(&pid, shell, NULL, &attr, argv, environ);
+	posix_spawnattr_destroy(&attr);
+	if (err) {
+		fprintf(stderr, "echinus: spawn '%s -c %s' failed: %s\n",
+		    shell, arg, strerror(err));
+		return;
 	}
-	wait(0);
+#else
+	/* posix_spawn() can't start a new session here */
+	if ((pid = fork()) == -1) {
+		perror("echinus: fork");
+		return;
+	}
+	if (pid == 0) {
+		setsid();
+		execv(shell, argv);
+		fprintf(stderr, "echinus: execv '%s -c %s'", shell, arg);
+		perror(" failed");
+		_exit(1);
+	}
+#endif
+	nchildren++;
+	DPRINTF("spawned %d in %ld ms, %d running\n", (int) pid, msnow() - t,
+	    nchildren);
 }
 
 void
 tag(const char *arg) {
-	unsigned int i;
-
 	if (!sel)
 		return;
-	for (i = 0; i < ntags; i++)
-		sel->tags[i] = (NULL == arg);
-	sel->tags[idxoftag(arg)] = True;
+	if (arg) {
+		tagsclear(sel->tags);
+		SETTAG(sel->tags, idxoftag(arg));
+	} else
+		tagsfill(sel->tags);
+	invalidateclient(sel);
 	updateatom[WindowDesk] (sel);
 	updateframe(sel);
 	arrange(NULL);
@@ -1963,10 +2938,11 @@ tag(const char *arg) {
 void
 bstack(Monitor * m) {
 	int i, n, nx, ny, nw, nh, mh, tw;
+	ClientArray *l;
 	Client *c, *mc;
 
-	for (n = 0, c = nexttiled(clients, m); c; c = nexttiled(c->next, m))
-		n++;
+	l = monlist(m, TiledList);
+	n = l->n;
 
 	mh = (n == 1) ? m->wah : views[m->curtag].mwfact * m->wah;
 	tw = (n > 1) ? m->waw / (n - 1) : 0;
@@ -1974,7 +2950,9 @@ bstack(Monitor * m) {
 	nx = m->wax;
 	ny = m->way;
 	nh = 0;
-	for (i = 0, c = mc = nexttiled(clients, m); c; c = nexttiled(c->next, m), i++) {
+	mc = n ? l->c[0] : NULL;
+	for (i = 0; i < n; i++) {
+		c = l->c[i];
 		c->ismax = False;
 		if (i == 0) {
 			nh = mh - 2 * c->border;
@@ -2001,10 +2979,11 @@ void
 tile(Monitor * m) {
 	int nx, ny, nw, nh, mw, mh;
 	unsigned int i, n, th;
+	ClientArray *l;
 	Client *c, *mc;
 
-	for (n = 0, c = nexttiled(clients, m); c; c = nexttiled(c->next, m))
-		n++;
+	l = monlist(m, TiledList);
+	n = l->n;
 
 	/* window geoms */
 	mh = (n <= views[m->curtag].nmaster) ? m->wah / (n >
@@ -2017,7 +2996,9 @@ tile(Monitor * m) {
 	nx = m->wax;
 	ny = m->way;
 	nw = 0;
-	for (i = 0, c = mc = nexttiled(clients, m); c; c = nexttiled(c->next, m), i++) {
+	mc = n ? l->c[0] : NULL;
+	for (i = 0; i < n; i++) {
+		c = l->c[i];
 		c->ismax = False;
 		if (i < views[m->curtag].nmaster) {	/* master */
 			ny = m->way + i * (mh - c->border);
@@ -2063,10 +3044,11 @@ togglefloating(const char *arg) {
 		return;
 
 	sel->isfloating = !sel->isfloating;
+	invalidateclient(sel);
 	updateframe(sel);
 	if (sel->isfloating) {
 		/* restore last known float dimensions */
-		resize(sel, sel->rx, sel->ry, sel->rw, sel->rh, False);
+		resize(sel, sel->cold->rx, sel->cold->ry, sel->cold->rw, sel->cold->rh, False);
 	} else {
 		/* save last known float dimensions */
 		save(sel);
@@ -2076,7 +3058,6 @@ togglefloating(const char *arg) {
 
 void
 togglefill(const char *arg) {
-	XEvent ev;
 	Monitor *m = curmonitor();
 	Client *c;
 	int x1, x2, y1, y2, w, h;
@@ -2116,14 +3097,13 @@ togglefill(const char *arg) {
 		save(sel);
 		resize(sel, x1, y1, w, h, True);
 	} else {
-		resize(sel, sel->rx, sel->ry, sel->rw, sel->rh, True);
+		resize(sel, sel->cold->rx, sel->cold->ry, sel->cold->rw, sel->cold->rh, True);
 	}
-	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+	ignoreenter();
 }
 
 void
 togglemax(const char *arg) {
-	XEvent ev;
 	Monitor *m = curmonitor();
 
 	if (!sel || sel->isfixed)
@@ -2135,22 +3115,22 @@ togglemax(const char *arg) {
 		resize(sel, m->wax - sel->border,
 		    m->way - sel->border - sel->th, m->waw, m->wah + sel->th, False);
 	} else {
-		resize(sel, sel->rx, sel->ry, sel->rw, sel->rh, True);
+		resize(sel, sel->cold->rx, sel->cold->ry, sel->cold->rw, sel->cold->rh, True);
 	}
-	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+	ignoreenter();
 }
 
 void
 toggletag(const char *arg) {
-	unsigned int i, j;
+	unsigned int i;
 
 	if (!sel)
 		return;
 	i = idxoftag(arg);
-	sel->tags[i] = !sel->tags[i];
-	for (j = 0; j < ntags && !sel->tags[j]; j++);
-	if (j == ntags)
-		sel->tags[i] = True;	/* at least one tag must be enabled */
+	FLIPTAG(sel->tags, i);
+	if (tagsempty(sel->tags))
+		SETTAG(sel->tags, i);	/* at least one tag must be enabled */
+	invalidateclient(sel);
 	drawclient(sel);
 	arrange(NULL);
 }
@@ -2165,6 +3145,7 @@ togglemonitor(const char *arg) {
 	if (!m)
 		return;
 	XWarpPointer(dpy, None, root, 0, 0, 0, 0, m->sx + x % m->sw, m->sy + y % m->sh);
+	setpointer(m->sx + x % m->sw, m->sy + y % m->sh);
 	focus(NULL);
 }
 
@@ -2176,16 +3157,18 @@ toggleview(const char *arg) {
 	i = idxoftag(arg);
 	cm = curmonitor();
 
-	memcpy(cm->prevtags, cm->seltags, ntags * sizeof(cm->seltags[0]));
-	cm->seltags[i] = !cm->seltags[i];
+	cm->prevtags = cm->seltags;
+	FLIPTAG(&cm->seltags, i);
+	invalidatelists(cm);
 	for (m = monitors; m; m = m->next) {
-		if (m->seltags[i] && m != cm) {
-			memcpy(m->prevtags, m->seltags, ntags * sizeof(m->seltags[0]));
-			m->seltags[i] = False;
-			for (j = 0; j < ntags && !m->seltags[j]; j++);
+		if (ISTAGGED(&m->seltags, i) && m != cm) {
+			m->prevtags = m->seltags;
+			CLEARTAG(&m->seltags, i);
+			invalidatelists(m);
+			for (j = 0; j < ntags && !ISTAGGED(&m->seltags, j); j++);
 			if (j == ntags) {
-				m->seltags[i] = True;	/* at least one tag must be viewed */
-				cm->seltags[i] = False; /* can't toggle */
+				SETTAG(&m->seltags, i);	/* at least one tag must be viewed */
+				CLEARTAG(&cm->seltags, i); /* can't toggle */
 				j = i;
 			}
 			if (m->curtag == i)
@@ -2205,15 +3188,15 @@ focusview(const char *arg) {
 
 	toggleview(arg);
 	i = idxoftag(arg);
-	if (!curseltags[i])
+	if (!ISTAGGED(&curseltags, i))
 		return;
 	for (c = stack; c; c = c->snext) {
-		if (c->tags[i] && !c->isbastard) {
+		if (ISTAGGED(c->tags, i) && !c->isbastard) {
 			focus(c);
 			break;
 		}
 	}
-	restack(curmonitor());
+	markdirty(curmonitor(), DirtyStack);
 }
 
 void
@@ -2228,6 +3211,9 @@ unban(Client * c) {
 	XSelectInput(dpy, c->frame, FRAMEMASK);
 	setclientstate(c, NormalState);
 	c->isbanned = False;
+	/* arranging is deferred, so focus() may have picked us while banned */
+	if (c == sel && selscreen && c->isfocusable)
+		XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
 }
 
 void
@@ -2235,20 +3221,25 @@ unmanage(Client * c) {
 	Monitor *m;
 	XWindowChanges wc;
 	Bool doarrange, dostruts;
-	Window trans;
 
 	m = clientmonitor(c);
 	doarrange = !(c->isfloating || c->isfixed
-	    || XGetTransientForHint(dpy, c->win, &trans)) || c->isbastard;
+	    || c->cold->transfor != None) || c->isbastard;
 	dostruts = c->hasstruts;
+	if (drag.c == c)
+		dragcancel();
 	/* The server grab construct avoids race conditions. */
 	XGrabServer(dpy);
 	XSelectInput(dpy, c->frame, NoEventMask);
 	XUnmapWindow(dpy, c->frame);
 	XSetErrorHandler(xerrordummy);
+	delwin(c->win);
+	delwin(c->frame);
 	if (c->title) {
-		XftDrawDestroy(c->xftdraw);
-		XFreePixmap(dpy, c->drawable);
+		delwin(c->title);
+		XftDrawDestroy(c->cold->xftdraw);
+		XFreePixmap(dpy, c->cold->drawable);
+		freetitles(c);
 		XDestroyWindow(dpy, c->title);
 		c->title = (Window) NULL;
 	}
@@ -2258,18 +3249,19 @@ unmanage(Client * c) {
 	XMoveWindow(dpy, c->win, c->x, c->y);
 	if (!running)
 		XMapWindow(dpy, c->win);
-	wc.border_width = c->oldborder;
+	wc.border_width = c->cold->oldborder;
 	XConfigureWindow(dpy, c->win, CWBorderWidth, &wc);	/* restore border */
 	detach(c);
 	detachstack(c);
+	ewmh_del_client(c->win);
+	syncfree(c);
 	if (sel == c)
 		focus(NULL);
 	setclientstate(c, WithdrawnState);
 	XDestroyWindow(dpy, c->frame);
-	/* c->tags points to monitor */
-	if (!c->isbastard)
-		free(c->tags);
-	free(c);
+	purgeprops(c->win);
+	purgeprops(c->frame);
+	freeclient(c);
 	XSync(dpy, False);
 	XSetErrorHandler(xerror);
 	XUngrabServer(dpy);
@@ -2279,7 +3271,7 @@ unmanage(Client * c) {
 	}
 	if (doarrange) 
 		arrange(m);
-	updateatom[ClientList] (NULL);
+	updateatom[ClientListStacking] (NULL);
 }
 
 void
@@ -2318,10 +3310,10 @@ unmapnotify(XEvent * e) {
 	Client *c;
 	XUnmapEvent *ev = &e->xunmap;
 
-	if ((c = getclient(ev->window, clients, ClientWindow)) /* && ev->send_event */) {
-		if (c->ignoreunmap--)
+	if ((c = getclient(ev->window, ClientWindow)) /* && ev->send_event */) {
+		if (c->cold->ignoreunmap--)
 			return;
-		DPRINTF("killing self-unmapped window (%s)\n", c->name);
+		DPRINTF("killing self-unmapped window (%s)\n", c->cold->name);
 		unmanage(c);
 	}
 }
@@ -2334,7 +3326,7 @@ updateframe(Client * c) {
 		return;
 
 	for (i = 0; i < ntags; i++) {
-		if (c->tags[i])
+		if (ISTAGGED(c->tags, i))
 			f += FEATURES(views[i].layout, OVERLAP);
 	}
 	c->th = !c->ismax && (c->isfloating || options.dectiled || f) ?
@@ -2347,53 +3339,63 @@ updateframe(Client * c) {
 
 void
 updatesizehints(Client * c) {
-	long msize;
+	ClientCold *cc = c->cold;
 	XSizeHints size;
 
-	if (!XGetWMNormalHints(dpy, c->win, &size, &msize) || !size.flags)
+	if (!getsizehints(c->win, &size) || !size.flags)
 		size.flags = PSize;
-	c->flags = size.flags;
-	if (c->flags & PBaseSize) {
-		c->basew = size.base_width;
-		c->baseh = size.base_height;
-	} else if (c->flags & PMinSize) {
-		c->basew = size.min_width;
-		c->baseh = size.min_height;
+	cc->flags = size.flags;
+	if (cc->flags & PBaseSize) {
+		cc->basew = size.base_width;
+		cc->baseh = size.base_height;
+	} else if (cc->flags & PMinSize) {
+		cc->basew = size.min_width;
+		cc->baseh = size.min_height;
 	} else
-		c->basew = c->baseh = 0;
-	if (c->flags & PResizeInc) {
-		c->incw = size.width_inc;
-		c->inch = size.height_inc;
+		cc->basew = cc->baseh = 0;
+	if (cc->flags & PResizeInc) {
+		cc->incw = size.width_inc;
+		cc->inch = size.height_inc;
 	} else
-		c->incw = c->inch = 0;
-	if (c->flags & PMaxSize) {
-		c->maxw = size.max_width;
-		c->maxh = size.max_height;
+		cc->incw = cc->inch = 0;
+	if (cc->flags & PMaxSize) {
+		cc->maxw = size.max_width;
+		cc->maxh = size.max_height;
 	} else
-		c->maxw = c->maxh = 0;
-	if (c->flags & PMinSize) {
-		c->minw = size.min_width;
-		c->minh = size.min_height;
-	} else if (c->flags & PBaseSize) {
-		c->minw = size.base_width;
-		c->minh = size.base_height;
+		cc->maxw = cc->maxh = 0;
+	if (cc->flags & PMinSize) {
+		cc->minw = size.min_width;
+		cc->minh = size.min_height;
+	} else if (cc->flags & PBaseSize) {
+		cc->minw = size.base_width;
+		cc->minh = size.base_height;
 	} else
-		c->minw = c->minh = 0;
-	if (c->flags & PAspect) {
-		c->minax = size.min_aspect.x;
-		c->maxax = size.max_aspect.x;
-		c->minay = size.min_aspect.y;
-		c->maxay = size.max_aspect.y;
+		cc->minw = cc->minh = 0;
+	if (cc->flags & PAspect) {
+		cc->minax = size.min_aspect.x;
+		cc->maxax = size.max_aspect.x;
+		cc->minay = size.min_aspect.y;
+		cc->maxay = size.max_aspect.y;
 	} else
-		c->minax = c->maxax = c->minay = c->maxay = 0;
-	c->isfixed = (c->maxw && c->minw && c->maxh && c->minh
-	    && c->maxw == c->minw && c->maxh == c->minh);
+		cc->minax = cc->maxax = cc->minay = cc->maxay = 0;
+	c->isfixed = (cc->maxw && cc->minw && cc->maxh && cc->minh
+	    && cc->maxw == cc->minw && cc->maxh == cc->minh);
+}
+
+void
+updatewmhints(Client * c) {
+	XWMHints wmh;
+
+	if (getwmhints(c->win, &wmh))
+		c->isfocusable = !(wmh.flags & InputHint) || wmh.input;
+	else	/* hints removed: back to the manage() default */
+		c->isfocusable = !c->isbastard;
 }
 
 void
 updatetitle(Client * c) {
-	if (!gettextprop(c->win, atom[WindowName], c->name, sizeof(c->name)))
-		gettextprop(c->win, atom[WMName], c->name, sizeof(c->name));
+	if (!gettextprop(c->win, atom[WindowName], c->cold->name, sizeof(c->cold->name)))
+		gettextprop(c->win, atom[WMName], c->cold->name, sizeof(c->cold->name));
 }
 
 /* There's no way to check accesses to destroyed windows, thus those cases are
@@ -2408,7 +3410,8 @@ xerror(Display * dsply, XErrorEvent * ee) {
 	    || (ee->request_code == X_PolySegment && ee->error_code == BadDrawable)
 	    || (ee->request_code == X_ConfigureWindow && ee->error_code == BadMatch)
 	    || (ee->request_code == X_GrabKey && ee->error_code == BadAccess)
-	    || (ee->request_code == X_CopyArea && ee->error_code == BadDrawable))
+	    || (ee->request_code == X_CopyArea && ee->error_code == BadDrawable)
+	    || syncerror(ee))
 		return 0;
 	fprintf(stderr,
 	    "echinus: fatal error: request code=%d, error code=%d\n",
@@ -2431,28 +3434,31 @@ xerrorstart(Display * dsply, XErrorEvent * ee) {
 
 void
 view(const char *arg) {
-	int i, j;
+	int i;
 	Monitor *m, *cm;
 	int prevtag;
 
 	i = idxoftag(arg);
 	cm = curmonitor();
 
-	if (cm->seltags[i])
+	if (ISTAGGED(&cm->seltags, i))
 		return;
 
-	memcpy(cm->prevtags, cm->seltags, ntags * sizeof(cm->seltags[0]));
-
-	for (j = 0; j < ntags; j++)
-		cm->seltags[j] = (arg == NULL);
-	cm->seltags[i] = True;
+	cm->prevtags = cm->seltags;
+	if (arg == NULL)
+		tagsfill(&cm->seltags);
+	else
+		tagsclear(&cm->seltags);
+	SETTAG(&cm->seltags, i);
+	invalidatelists(cm);
 	prevtag = cm->curtag;
 	cm->curtag = i;
 	for (m = monitors; m; m = m->next) {
-		if (m->seltags[i] && m != cm) {
+		if (ISTAGGED(&m->seltags, i) && m != cm) {
 			m->curtag = prevtag;
-			memcpy(m->prevtags, m->seltags, ntags * sizeof(m->seltags[0]));
-			memcpy(m->seltags, cm->prevtags, ntags * sizeof(cm->seltags[0]));
+			m->prevtags = m->seltags;
+			m->seltags = cm->prevtags;
+			invalidatelists(m);
 			updategeom(m);
 			arrange(m);
 		}
@@ -2465,20 +3471,22 @@ view(const char *arg) {
 
 void
 viewprevtag(const char *arg) {
-	Bool tmptags[ntags];
+	Monitor *cm = curmonitor();
+	Tags tmptags;
 	unsigned int i = 0;
 	int prevcurtag;
 
-	while (i < ntags - 1 && !curprevtags[i])
+	while (i < ntags - 1 && !ISTAGGED(&cm->prevtags, i))
 		i++;
-	prevcurtag = curmontag;
-	curmontag = i;
-
-	memcpy(tmptags, curseltags, ntags * sizeof(curseltags[0]));
-	memcpy(curseltags, curprevtags, ntags * sizeof(curseltags[0]));
-	memcpy(curprevtags, tmptags, ntags * sizeof(curseltags[0]));
-	if (views[prevcurtag].barpos != views[curmontag].barpos)
-		updategeom(curmonitor());
+	prevcurtag = cm->curtag;
+	cm->curtag = i;
+
+	tmptags = cm->seltags;
+	cm->seltags = cm->prevtags;
+	cm->prevtags = tmptags;
+	invalidatelists(cm);
+	if (views[prevcurtag].barpos != views[cm->curtag].barpos)
+		updategeom(cm);
 	arrange(NULL);
 	focus(NULL);
 	updateatom[CurDesk] (NULL);
@@ -2489,7 +3497,7 @@ viewlefttag(const char *arg) {
 	unsigned int i;
 
 	for (i = 0; i < ntags; i++) {
-		if (i && curseltags[i]) {
+		if (i && ISTAGGED(&curseltags, i)) {
 			view(tags[i - 1]);
 			break;
 		}
@@ -2501,7 +3509,7 @@ viewrighttag(const char *arg) {
 	unsigned int i;
 
 	for (i = 0; i < ntags - 1; i++) {
-		if (curseltags[i]) {
+		if (ISTAGGED(&curseltags, i)) {
 			view(tags[i + 1]);
 			break;
 		}
@@ -2537,9 +3545,8 @@ main(int argc, char *argv[]) {
 	setlocale(LC_CTYPE, "");
 	if (!(dpy = XOpenDisplay(0)))
 		eprint("echinus: cannot open display\n");
-	signal(SIGHUP, sighandler);
-	signal(SIGINT, sighandler);
-	signal(SIGQUIT, sighandler);
+	fcntl(ConnectionNumber(dpy), F_SETFD, FD_CLOEXEC);
+	initsignals();
 	cargv = argv;
 	screen = DefaultScreen(dpy);
 	root = RootWindow(dpy, screen);
@@ -8,23 +8,67 @@ enum { ClientList, ActiveWindow, WindowDesk,
 	WindowName, WindowState, WindowStateFs, WindowStateModal,
 	WindowStateHidden, WMCheck,
 	Utf8String, Supported, WMProto, WMDelete, WMName, WMState, WMChangeState,
-	WMTakeFocus, MWMHints, NATOMS
+	WMTakeFocus, MWMHints, WMSyncRequest, WMSyncCounter, NATOMS
 }; /* keep in sync with atomnames[][] in ewmh.c */
 
 enum { LeftStrut, RightStrut, TopStrut, BotStrut, LastStrut }; /* ewmh struts */
 enum { ColFG, ColBG, ColBorder, ColButton, ColLast };	/* colors */
-enum { ClientWindow, ClientTitle, ClientFrame };	/* client parts */
+enum { ClientWindow, ClientTitle, ClientFrame, ClientAlarm };	/* client parts */
 enum { Iconify, Maximize, Close, LastBtn }; /* window buttons */
+enum { TiledList, FloatList, IconList, BastardList, LastList }; /* monitor client lists */
+enum { LayerDock, LayerFloat, LayerTiled, LayerDesk, LastLayer }; /* stacking, top to bottom */
+enum { TypeDesk = 1, TypeDock = 2, TypeDialog = 4 }; /* _NET_WM_WINDOW_TYPE bits */
+enum { ProtoDelete = 1, ProtoTakeFocus = 2, ProtoSyncRequest = 4 }; /* WM_PROTOCOLS bits */
+enum { DirtyLayout = 1, DirtyStack = 2, DirtyVisible = 4 }; /* pending monitor work */
+
+/* tags are kept as bitsets: one machine word for up to 64 tags */
+#ifndef MAXTAGS
+#define MAXTAGS		64
+#endif
+#define TAGBITS		(8 * sizeof(unsigned long))
+#define TAGWORDS	((MAXTAGS + TAGBITS - 1) / TAGBITS)
+#define TAGWORD(_i)	((_i) / TAGBITS)
+#define TAGBIT(_i)	(1UL << ((_i) % TAGBITS))
+#define ISTAGGED(_t, _i)	(!!((_t)->w[TAGWORD(_i)] & TAGBIT(_i)))
+
+#define MAXMONS		(8 * sizeof(unsigned long))
+#define MONBIT(_m)	(1UL << (_m)->num)
+#define SETTAG(_t, _i)		((_t)->w[TAGWORD(_i)] |= TAGBIT(_i))
+#define CLEARTAG(_t, _i)	((_t)->w[TAGWORD(_i)] &= ~TAGBIT(_i))
+#define FLIPTAG(_t, _i)		((_t)->w[TAGWORD(_i)] ^= TAGBIT(_i))
 
 /* typedefs */
+typedef struct {
+	unsigned long w[TAGWORDS];
+} Tags;
+
+typedef struct Client Client;
+typedef struct ClientCold ClientCold;
+
+typedef struct {
+	unsigned int slot, gen;
+} ClientRef; /* a client that may have gone away, see deref() */
+
+typedef struct {
+	Client **c;
+	unsigned int n, size;
+} ClientArray; /* visible clients of a monitor, in client list order */
+
 typedef struct Monitor Monitor;
 struct Monitor {
 	int sx, sy, sw, sh, wax, way, waw, wah;
 	unsigned long struts[LastStrut];
-	Bool *seltags;
-	Bool *prevtags;
+	Tags seltags;
+	Tags prevtags;
 	Monitor *next;
 	unsigned int curtag;
+	ClientArray lists[LastList];
+	Bool listsvalid;	/* else rebuilt by monlist() on next use */
+	int num;		/* its bit in Client.inlists */
+	int dirty;		/* Dirty* bits, serviced by arrangedirty() */
+	Window *order;		/* frames as last restacked, top to bottom */
+	unsigned int norder, sorder;
+	int refresh;		/* Hz, paces interactive move/resize */
 };
 
 typedef struct {
@@ -42,31 +86,82 @@ typedef struct {
 #define M2LT(_mon) (views[(_mon)->curtag].layout)
 #define MFEATURES(_monitor, _which) ((_monitor) && FEATURES(M2LT(_monitor), (_which)))
 
-typedef struct Client Client;
-struct Client {
+typedef struct {
+	Pixmap pm;		/* None until drawn */
+	int w;			/* what it was drawn for */
+	Tags tags;
 	char name[256];
+	int bx[LastBtn];	/* button[].x as drawn */
+} TitleCache;
+
+struct Client {
+	/* read by the layouts and list walks, keep these together */
+	unsigned int slot;	/* in the client table, for ClientRef */
+	unsigned int gen;	/* odd while in use */
+	Client *next;
+	Client *prev;
+	Client *snext;
+	Client *sprev;
+	Tags *tags;		/* &tagbits, or the monitor's seltags for bastards */
+	Tags tagbits;
+	Monitor *mon;		/* clientmonitor() cache, valid while mongen == viewgen */
+	unsigned long mongen;
+	unsigned long inlists;	/* monitors whose lists hold it, by Monitor.num */
+	unsigned long seq;	/* attach() order, the newest is highest */
 	int x, y, w, h;
-	int rx, ry, rw, rh;	/* revert geometry */
 	int th;			/* title height */
-	int basew, baseh, incw, inch, maxw, maxh, minw, minh;
-	int minax, maxax, minay, maxay;
-	int ignoreunmap;
-	long flags;
-	int border, oldborder;
+	int border;
+	int wintype;		/* cached _NET_WM_WINDOW_TYPE bits */
 	Bool isbanned, ismax, isfloating, wasfloating;
 	Bool isicon, isfill;
 	Bool isfixed, isbastard, isfocusable, hasstruts;
-	Bool *tags;
-	Client *next;
-	Client *prev;
-	Client *snext;
 	Window win;
 	Window title;
 	Window frame;
+	ClientCold *cold;
+};
+
+/* only touched on resize, redraw and property changes, kept out of the
+ * way of the list walks; allocclient() hands it out with the Client */
+struct ClientCold {
+	int rx, ry, rw, rh;	/* revert geometry */
+	int basew, baseh, incw, inch, maxw, maxh, minw, minh;
+	int minax, maxax, minay, maxay;
+	int ignoreunmap;
+	int oldborder;
+	Bool wireframe;		/* move/resize as an outline */
+	int protocols;		/* cached WM_PROTOCOLS bits */
+	Window transfor;	/* cached WM_TRANSIENT_FOR */
+	Tags listed;		/* the taglists it is filed in */
+	unsigned long stackgen;	/* last _NET_CLIENT_LIST_STACKING it went in */
+	XID synccounter;	/* _NET_WM_SYNC_REQUEST_COUNTER */
+	XID syncalarm;		/* fires when the counter reaches syncvalue */
+	unsigned int syncvalue;	/* last value asked for */
+	long syncdue;		/* give up waiting at this msnow() */
+	Bool syncwait;
+	long flags;
 	Pixmap drawable;
 	XftDraw *xftdraw;
+	TitleCache titles[2];	/* rendered normal and selected */
+	char name[256];
+};
+
+typedef struct Timer Timer;
+struct Timer {
+	long due;		/* msnow() when it fires */
+	void (*func) (void *arg);
+	void *arg;
+	Timer *next;
 };
 
+typedef struct ClientWin ClientWin;
+struct ClientWin {
+	Window w;
+	Client *c;
+	int part;
+	ClientWin *next;
+}; /* window id -> client lookup entry */
+
 typedef struct View {
 	int barpos;
 	int nmaster;
@@ -109,6 +204,7 @@ typedef struct {
 	char *tags;
 	Bool isfloating;
 	Bool hastitle;
+	int wireframe;		/* -1 follows the global setting */
 	regex_t *propregex;
 	regex_t *tagregex;
 } Rule; /* window matching rules */
@@ -116,25 +212,59 @@ typedef struct {
 /* ewmh.c */
 Bool checkatom(Window win, Atom bigatom, Atom smallatom);
 void clientmessage(XEvent * e);
+void ewmh_add_client(Window w);
+void ewmh_del_client(Window w);
 void ewmh_process_state_atom(Client * c, Atom state, int set);
 void *getatom(Window win, Atom atom, unsigned long *nitems);
+Bool getclasshint(Window win, XClassHint * ch);
+unsigned char *getprop(Window win, Atom prop, long len, Atom * type,
+    int *format, unsigned long *n);
+Bool getsizehints(Window win, XSizeHints * size);
+Bool gettransient(Window win, Window * trans);
+Bool getwmhints(Window win, XWMHints * wmh);
+int getprotocols(Window win);
+int getwintype(Window win);
 void initewmh(void);
 void mwm_process_atom(Client * c);
+void prefetch(Window * wins, unsigned int n);
+Bool prefetched(Window win);
+void unfetch(void);
+void delprop(Window win, Atom prop);
+void forgetprop(Window win, Atom prop);
+void propreport(void);
+void purgeprops(Window win);
+void setprop(Window win, Atom prop, Atom type, int format, int mode,
+    const void *data, int n);
 void setopacity(Client * c, unsigned int opacity);
 extern void (*updateatom[]) (Client *);
 int getstruts(Client * c);
+XID getsynccounter(Window win);
+Client *syncdone(XEvent * e);
+Bool syncerror(XErrorEvent * ee);
+void syncfree(Client * c);
+Bool syncpending(Client * c);
+void syncrequest(Client * c);
+extern int syncevent;
 
 /* main */
 void arrange(Monitor * m);
+void addwin(Window w, Client * c, int part);
+void delwin(Window w);
+void markdirty(Monitor * m, int what);
 Monitor *clientmonitor(Client * c);
 Monitor *curmonitor();
+ClientRef clientref(Client * c);
+Client *deref(ClientRef r);
 void *emallocz(unsigned int size);
+void *erealloc(void *ptr, unsigned int size);
 void eprint(const char *errstr, ...);
 const char *getresource(const char *resource, const char *defval);
-Client *getclient(Window w, Client * list, int part);
+Client *getclient(Window w, int part);
 Monitor *getmonitor(int x, int y);
 void iconify(const char *arg);
 void incnmaster(const char *arg);
+void invalidateclient(Client * c);
+void invalidatelists(Monitor * m);
 Bool isvisible(Client * c, Monitor * m);
 void focus(Client * c);
 void focusicon(const char *arg);
@@ -143,6 +273,7 @@ void focusprev(const char *arg);
 void focusview(const char *arg);
 void killclient(const char *arg);
 void moveresizekb(const char *arg);
+long msnow(void);
 void quit(const char *arg);
 void restart(const char *arg);
 void setmwfact(const char *arg);
@@ -168,6 +299,9 @@ int initkeys();
 
 /* draw.c */
 void drawclient(Client * c);
+void freetitles(Client * c);
+void drawoutline(Client * c, int x, int y, int w, int h);
+void hideoutline(void);
 void deinitstyle();
 void initstyle();
 
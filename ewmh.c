@@ -13,10 +13,22 @@
 #include <X11/Xproto.h>
 #include <X11/Xutil.h>
 #include <X11/Xft/Xft.h>
+#ifdef XSYNC
+#include <X11/extensions/sync.h>
+#endif
 #include "echinus.h"
 #include "config.h"
+/* for prefetch(): Xlib has no public call that pipelines requests */
+#undef min
+#undef max
+#include <X11/Xlibint.h>
 
 Atom atom[NATOMS];
+int syncevent;		/* XSyncAlarmNotify, 0 without the extension */
+#ifdef XSYNC
+Bool hassync;
+static int syncerrbase;
+#endif
 
 /* keep in sync with enum in echinus.h */
 const char *atomnames[NATOMS][1] = {
@@ -51,6 +63,8 @@ const char *atomnames[NATOMS][1] = {
 	{ "WM_CHANGE_STATE"		},
 	{ "WM_TAKE_FOCUS"		},
 	{ "_MOTIF_WM_HINTS"		},
+	{ "_NET_WM_SYNC_REQUEST"	},
+	{ "_NET_WM_SYNC_REQUEST_COUNTER" },
 };
 
 void
@@ -59,6 +73,16 @@ initewmh(void) {
 	char name[] = "echinus";
 	XSetWindowAttributes wa;
 	Window win;
+#ifdef XSYNC
+	int evbase, errbase, major, minor;
+
+	hassync = XSyncQueryExtension(dpy, &evbase, &errbase) &&
+	    XSyncInitialize(dpy, &major, &minor);
+	if (hassync) {
+		syncevent = evbase + XSyncAlarmNotify;
+		syncerrbase = errbase;
+	}
+#endif
 
 	for (i = 0; i < NATOMS; i++)
 		atom[i] = XInternAtom(dpy, atomnames[i][0], False);
@@ -74,78 +98,269 @@ initewmh(void) {
 		       	PropModeReplace, (unsigned char*)name, strlen(name));
 	XChangeProperty(dpy, root, atom[WMCheck], XA_WINDOW, 32,
 		       	PropModeReplace, (unsigned char*)&win, 1);
+	/* clients are appended to it as they get managed */
+	XChangeProperty(dpy, root, atom[ClientList], XA_WINDOW, 32,
+		       	PropModeReplace, NULL, 0);
 }
 
 void
 update_echinus_layout_name(Client *c) {
-	XChangeProperty(dpy, root, atom[ELayout],
-	    XA_STRING, 8, PropModeReplace,
-	    (const unsigned char *) &views[curmontag].layout->symbol, 1L);
+	setprop(root, atom[ELayout], XA_STRING, 8, PropModeReplace,
+	    &views[curmontag].layout->symbol, 1);
+}
+
+/* Properties we set are remembered per (window, atom) as last written,
+ * so writing the same value again doesn't reach the server and wake up
+ * every panel and compositor listening for it. */
+typedef struct Prop Prop;
+struct Prop {
+	Window win;
+	Atom atom;
+	Atom type;
+	int format;
+	int n;			/* -1 once deleted, -2 unknown */
+	unsigned char *data;
+	Prop *next;
+};
+
+#define PROPTAB	256
+static Prop *proptab[PROPTAB];
+static unsigned long prophits, propmisses, propbytes;
+static unsigned long totalhits, totalmisses, totalbytes;
+
+static Prop *
+findprop(Window win, Atom prop, Bool create) {
+	Prop *p, **h;
+
+	h = &proptab[(win ^ prop * 31) % PROPTAB];
+	for (p = *h; p; p = p->next)
+		if (p->win == win && p->atom == prop)
+			return p;
+	if (!create)
+		return NULL;
+	p = emallocz(sizeof(Prop));
+	p->win = win;
+	p->atom = prop;
+	p->n = -2;
+	p->next = *h;
+	*h = p;
+	return p;
+}
+
+static void
+propstats(unsigned long bytes) {
+	static long since;
+	long now;
+
+	propmisses++;
+	propbytes += bytes;
+	totalmisses++;
+	totalbytes += bytes;
+	if ((now = msnow()) - since >= 1000) {
+		DPRINTF("%lu property bytes written in %ld ms, %lu hits %lu misses\n",
+		    propbytes, now - since, prophits, propmisses);
+		propbytes = 0;
+		since = now;
+	}
+}
+
+/* on SIGUSR1, in any build */
+void
+propreport(void) {
+	fprintf(stderr, "echinus: %lu property bytes written, %lu writes, "
+	    "%lu skipped as unchanged\n", totalbytes, totalmisses, totalhits);
+}
+
+void
+setprop(Window win, Atom prop, Atom type, int format, int mode,
+    const void *data, int n) {
+	Prop *p;
+	size_t size;
+
+	/* what Xlib reads from data: format 32 comes as longs */
+	size = n * (format == 32 ? sizeof(long) : format == 16 ? sizeof(short) : 1);
+	p = findprop(win, prop, mode == PropModeReplace);
+	if (mode == PropModeReplace && p->n == n && p->type == type &&
+	    p->format == format && (!size || !memcmp(p->data, data, size))) {
+		prophits++;
+		totalhits++;
+		return;
+	}
+	XChangeProperty(dpy, win, prop, type, format, mode,
+	    (const unsigned char *) data, n);
+	propstats(n * (format / 8));
+	if (!p)
+		return;
+	if (mode != PropModeReplace) {
+		p->n = -2;	/* appended to, the whole value is unknown */
+		return;
+	}
+	free(p->data);
+	p->data = NULL;
+	if (size) {
+		p->data = emallocz(size);
+		memcpy(p->data, data, size);
+	}
+	p->type = type;
+	p->format = format;
+	p->n = n;
+}
+
+void
+delprop(Window win, Atom prop) {
+	Prop *p;
+
+	p = findprop(win, prop, True);
+	if (p->n == -1) {
+		prophits++;
+		totalhits++;
+		return;
+	}
+	XDeleteProperty(dpy, win, prop);
+	propstats(0);
+	free(p->data);
+	p->data = NULL;
+	p->n = -1;
+}
+
+/* someone else may have written it, the next write goes through */
+void
+forgetprop(Window win, Atom prop) {
+	Prop *p;
+
+	if (!(p = findprop(win, prop, False)))
+		return;
+	free(p->data);
+	p->data = NULL;
+	p->n = -2;
+}
+
+/* forget about a window that is no longer ours */
+void
+purgeprops(Window win) {
+	Prop *p, **pp;
+	int i;
+
+	for (i = 0; i < PROPTAB; i++)
+		for (pp = &proptab[i]; (p = *pp);) {
+			if (p->win == win) {
+				*pp = p->next;
+				free(p->data);
+				free(p);
+			} else
+				pp = &p->next;
+		}
 }
 
+/* _NET_CLIENT_LIST is kept in mapping order: new clients are appended
+ * to the property, only removals rewrite it */
+static Window *clientlist;
+static int nclientlist, sclientlist;
+
+void
+ewmh_add_client(Window w) {
+	if (nclientlist == sclientlist) {
+		sclientlist = sclientlist ? 2 * sclientlist : 64;
+		clientlist = erealloc(clientlist, sclientlist * sizeof(Window));
+	}
+	clientlist[nclientlist++] = w;
+	setprop(root, atom[ClientList], XA_WINDOW, 32, PropModeAppend, &w, 1);
+}
+
+void
+ewmh_del_client(Window w) {
+	int i;
+
+	for (i = 0; i < nclientlist && clientlist[i] != w; i++);
+	if (i == nclientlist)
+		return;
+	memmove(clientlist + i, clientlist + i + 1,
+	    (--nclientlist - i) * sizeof(Window));
+	setprop(root, atom[ClientList], XA_WINDOW, 32, PropModeReplace,
+	    clientlist, nclientlist);
+}
+
+/* bottom to top as restack() last told the server, monitor by monitor,
+ * with the clients no monitor shows underneath */
 void
-ewmh_update_net_client_list() {
-	Window *wins = NULL;
+ewmh_update_net_client_list_stacking() {
+	static Window *wins, *prev;
+	static int nprev, size;
+	static unsigned long gen;
+	Window *t;
+	Monitor *m;
 	Client *c;
-	int i, n = 0;
+	unsigned int j;
+	int i, n;
 
-	for (c = stack; c; c = c->snext)
+	for (n = 0, c = clients; c; c = c->next)
 		n++;
-	if (!n) {
-		XChangeProperty(dpy, root, atom[ClientList], XA_WINDOW, 32,
-			       	PropModeReplace, (unsigned char *) wins, n);
-		XChangeProperty(dpy, root, atom[ClientListStacking], XA_WINDOW,
-			       	32, PropModeReplace, (unsigned char *) wins, n);
-		return;
+	if (n > size) {
+		size = n;
+		wins = erealloc(wins, size * sizeof(Window));
+		prev = erealloc(prev, size * sizeof(Window));
 	}
-	wins = malloc(sizeof(Window) * n);
-	for (i = 0, c = stack; c; c = c->snext)
-		wins[i++] = c->win;
-	XChangeProperty(dpy, root,
-	    atom[ClientListStacking], XA_WINDOW, 32, PropModeReplace,
-	    (unsigned char *) wins, n);
-	for (i = 0, c = clients; c; c = c->next)
-		wins[i++] = c->win;
-	XChangeProperty(dpy, root,
-	    atom[ClientList], XA_WINDOW, 32, PropModeReplace, (unsigned char *) wins, n);
-	free(wins);
-	XFlush(dpy);
+	/* filled from the top down, each client once: those listed this
+	 * time round carry its generation */
+	i = n;
+	gen++;
+	for (m = monitors; m; m = m->next)
+		for (j = 0; j < m->norder; j++)
+			if (i > 0 && (c = getclient(m->order[j], ClientFrame))
+			    && c->cold->stackgen != gen) {
+				c->cold->stackgen = gen;
+				wins[--i] = c->win;
+			}
+	for (c = clients; c && i > 0; c = c->next)
+		if (c->cold->stackgen != gen) {
+			c->cold->stackgen = gen;
+			wins[--i] = c->win;
+		}
+	if (i || (n == nprev && !memcmp(wins, prev, n * sizeof(Window))))
+		return;
+	t = prev;
+	prev = wins;
+	wins = t;
+	nprev = n;
+	setprop(root, atom[ClientListStacking], XA_WINDOW, 32,
+	    PropModeReplace, prev, n);
 }
 
 void
 ewmh_update_net_number_of_desktops() {
-	XChangeProperty(dpy, root,
-	    atom[NumberOfDesk], XA_CARDINAL, 32, PropModeReplace,
-	    (unsigned char *) &ntags, 1);
+	long n = ntags;
+
+	setprop(root, atom[NumberOfDesk], XA_CARDINAL, 32, PropModeReplace,
+	    &n, 1);
 }
 
 void
 ewmh_update_net_current_desktop() {
 	Monitor *m;
-	unsigned long *seltags;
+	unsigned long seltags[MAXTAGS] = { 0 };
+	long cur = curmontag;
 	unsigned int i;
 
-	seltags = emallocz(ntags * sizeof(unsigned long));
 	for (m = monitors; m != NULL; m = m->next) {
 		for (i = 0; i < ntags; i++)
-			seltags[i] |= m->seltags[i];
+			seltags[i] |= ISTAGGED(&m->seltags, i);
 	}
-	XChangeProperty(dpy, root,
-	    atom[ESelTags], XA_CARDINAL, 32, PropModeReplace,
-	    (unsigned char *) seltags, ntags);
-	XChangeProperty(dpy, root, atom[CurDesk], XA_CARDINAL, 32,
-	    PropModeReplace, (unsigned char *) &curmontag, 1);
+	setprop(root, atom[ESelTags], XA_CARDINAL, 32, PropModeReplace,
+	    seltags, ntags);
+	setprop(root, atom[CurDesk], XA_CARDINAL, 32, PropModeReplace,
+	    &cur, 1);
 	update_echinus_layout_name(NULL);
-	free(seltags);
 }
 
 void
 ewmh_update_net_window_desktop(Client *c) {
 	unsigned int i;
+	long desk;
 
-	for (i = 0; i < ntags && !c->tags[i]; i++);
-	XChangeProperty(dpy, c->win,
-	    atom[WindowDesk], XA_CARDINAL, 32, PropModeReplace, (unsigned char *) &i, 1);
+	for (i = 0; i < ntags && !ISTAGGED(c->tags, i); i++);
+	desk = i;
+	setprop(c->win, atom[WindowDesk], XA_CARDINAL, 32, PropModeReplace,
+	    &desk, 1);
 }
 
 void
@@ -160,8 +375,8 @@ ewmh_update_net_work_area(Client *c) {
 		geoms[i*4+2] = DisplayWidth(dpy, screen);
 		geoms[i*4+3] = DisplayHeight(dpy, screen);
 	}
-	XChangeProperty(dpy, root,
-	    atom[WorkArea], XA_CARDINAL, 32, PropModeReplace, (unsigned char *) geoms, ntags*4);
+	setprop(root, atom[WorkArea], XA_CARDINAL, 32, PropModeReplace,
+	    geoms, ntags*4);
 	free(geoms);
 }
 
@@ -178,9 +393,8 @@ ewmh_update_net_desktop_names() {
 	}
 	len = pos - buf;
 
-	XChangeProperty(dpy, root,
-	    atom[DeskNames], atom[Utf8String], 8, PropModeReplace,
-	    (unsigned char *) buf, len);
+	setprop(root, atom[DeskNames], atom[Utf8String], 8, PropModeReplace,
+	    buf, len);
 }
 
 void
@@ -188,38 +402,34 @@ ewmh_update_net_active_window() {
 	Window win;
 
 	win = sel ? sel->win : None;
-	XChangeProperty(dpy, root,
-	    atom[ActiveWindow], XA_WINDOW, 32, PropModeReplace,
-	    (unsigned char *) &win, 1);
+	setprop(root, atom[ActiveWindow], XA_WINDOW, 32, PropModeReplace,
+	    &win, 1);
 }
 
 void
 mwm_process_atom(Client *c) {
 	Atom real;
 	int format;
-	unsigned char *data = NULL;
-	CARD32 *hint;
-	unsigned long n, extra;
+	long *hint;
+	unsigned long n;
 #define MWM_HINTS_ELEMENTS 5
 #define MWM_DECOR_ALL(x) ((x) & (1L << 0))
 #define MWM_DECOR_TITLE(x) ((x) & (1L << 3))
 #define MWM_DECOR_BORDER(x) ((x) & (1L << 1))
 #define MWM_HINTS_DECOR(x) ((x) & (1L << 1))
-	if (XGetWindowProperty(dpy, c->win, atom[MWMHints], 0L, 20L, False,
-		atom[MWMHints], &real, &format, &n, &extra,
-		(unsigned char **) &data) == Success && n >= MWM_HINTS_ELEMENTS) {
-		hint = (CARD32 *) data;
+	hint = (long *) getprop(c->win, atom[MWMHints], 20L, &real, &format, &n);
+	if (real == atom[MWMHints] && n >= MWM_HINTS_ELEMENTS) {
 		if (MWM_HINTS_DECOR(hint[0]) && !(MWM_DECOR_ALL(hint[2]))) {
 			c->title = MWM_DECOR_TITLE(hint[2]) ? root : (Window) NULL;
 			c->border = MWM_DECOR_BORDER(hint[2]) ? style.border : 0;
 		}
 	}
-	XFree(data);
+	XFree(hint);
 }
 
 void
 ewmh_process_state_atom(Client *c, Atom state, int set) {
-	CARD32 data[2];
+	long data[2];
 
 	data[1] = None;
 	if (state == atom[WindowStateFs]) {
@@ -233,12 +443,13 @@ ewmh_process_state_atom(Client *c, Atom state, int set) {
 			c->wasfloating = True;
 			data[0] = None;
 		}
-		XChangeProperty(dpy, c->win, atom[WindowState], XA_ATOM, 32,
-		    PropModeReplace, (unsigned char *) data, 2);
+		invalidateclient(c);
+		setprop(c->win, atom[WindowState], XA_ATOM, 32,
+		    PropModeReplace, data, 2);
 		DPRINT;
 		togglemax(NULL);
 		arrange(curmonitor());
-		DPRINTF("%s: x%d y%d w%d h%d\n", c->name, c->x, c->y, c->w, c->h);
+		DPRINTF("%s: x%d y%d w%d h%d\n", c->cold->name, c->x, c->y, c->w, c->h);
 	}
 	if (state == atom[WindowStateModal])
 		focus(c);
@@ -250,22 +461,23 @@ clientmessage(XEvent *e) {
 	Client *c;
 
 	if (ev->message_type == atom[ActiveWindow]) {
-		if ((c = getclient(ev->window, clients, ClientWindow))) {
+		if ((c = getclient(ev->window, ClientWindow))) {
 				c->isicon = False;
+				invalidateclient(c);
 				focus(c);
 				arrange(curmonitor());
 		}
 	} else if (ev->message_type == atom[CurDesk]) {
 		view(tags[ev->data.l[0]]);
 	} else if (ev->message_type == atom[WindowState]) {
-		if ((c = getclient(ev->window, clients, ClientWindow))) {
+		if ((c = getclient(ev->window, ClientWindow))) {
 			ewmh_process_state_atom(c, (Atom) ev->data.l[1], ev->data.l[0]);
 			if (ev->data.l[2])
 				ewmh_process_state_atom(c,
 				    (Atom) ev->data.l[2], ev->data.l[0]);
 		}
 	} else if (ev->message_type == atom[WMChangeState]) {
-		if ((c = getclient(ev->window, clients, ClientWindow))) {
+		if ((c = getclient(ev->window, ClientWindow))) {
 			if (ev->data.l[0] == IconicState) {
 				focus(c);
 				iconify(NULL);
@@ -276,35 +488,304 @@ clientmessage(XEvent *e) {
 
 void
 setopacity(Client *c, unsigned int opacity) {
+	unsigned long data = opacity;
+
 	if (opacity == OPAQUE) {
-		XDeleteProperty(dpy, c->win, atom[WindowOpacity]);
-		XDeleteProperty(dpy, c->frame, atom[WindowOpacity]);
+		delprop(c->win, atom[WindowOpacity]);
+		delprop(c->frame, atom[WindowOpacity]);
 	} else {
-		XChangeProperty(dpy, c->win, atom[WindowOpacity],
-		    XA_CARDINAL, 32, PropModeReplace, (unsigned char *) &opacity, 1L);
-		XChangeProperty(dpy, c->frame, atom[WindowOpacity],
-		    XA_CARDINAL, 32, PropModeReplace, (unsigned char *) &opacity, 1L);
+		setprop(c->win, atom[WindowOpacity], XA_CARDINAL, 32,
+		    PropModeReplace, &data, 1);
+		setprop(c->frame, atom[WindowOpacity], XA_CARDINAL, 32,
+		    PropModeReplace, &data, 1);
+	}
+}
+
+/* Reading a property is a round trip, and manage() reads about a dozen.
+ * prefetch() asks for all of them, for any number of windows, and waits
+ * once for the lot; getprop() answers from that until unfetch(). */
+#define FETCHLEN	1024L	/* longs, enough for any of them */
+
+typedef struct {
+	Window win;
+	Atom atom;
+	Atom type;
+	int format;
+	unsigned long n;
+	unsigned char *data;	/* as XGetWindowProperty() returns it */
+} Fetched;
+
+typedef struct {
+	uint64_t first, last;	/* our requests */
+	Fetched *f;
+} FetchState;
+
+static Fetched *fetched;	/* by window, then atom */
+static unsigned int nfetched;
+
+static Bool
+fetchreply(Display *d, xReply *rep, char *buf, int len, XPointer data) {
+	FetchState *s = (FetchState *) data;
+	uint64_t seq = X_DPY_GET_LAST_REQUEST_READ(d);
+	xGetPropertyReply replbuf, *r;
+	Fetched *f;
+	CARD32 *raw;
+	unsigned long i, size;
+
+	/* errors are xerror()'s, the property stays missing */
+	if (seq < s->first || seq > s->last || rep->generic.type == X_Error)
+		return False;
+	f = &s->f[seq - s->first];
+	r = (xGetPropertyReply *) _XGetAsyncReply(d, (char *) &replbuf, rep,
+	    buf, len, (SIZEOF(xGetPropertyReply) - SIZEOF(xReply)) >> 2, False);
+	size = r->propertyType == None ? 0 : r->nItems * (r->format / 8);
+	if (!size || (r->format != 8 && r->format != 16 && r->format != 32)) {
+		_XGetAsyncData(d, NULL, buf, len, SIZEOF(xGetPropertyReply), 0,
+		    r->length << 2);
+		return True;
+	}
+	f->type = r->propertyType;
+	f->format = r->format;
+	f->n = r->nItems;
+	if (f->format != 32) {
+		/* zero terminated, as Xlib does */
+		f->data = emallocz(size + 1);
+		_XGetAsyncData(d, (char *) f->data, buf, len,
+		    SIZEOF(xGetPropertyReply), size, r->length << 2);
+		return True;
+	}
+	/* format 32 comes as longs */
+	raw = emallocz(size);
+	_XGetAsyncData(d, (char *) raw, buf, len, SIZEOF(xGetPropertyReply),
+	    size, r->length << 2);
+	f->data = emallocz((f->n + 1) * sizeof(long));
+	for (i = 0; i < f->n; i++)
+		((long *) f->data)[i] = (INT32) raw[i];
+	free(raw);
+	return True;
+}
+
+static int
+fetchcmp(const void *a, const void *b) {
+	const Fetched *x = a, *y = b;
+
+	if (x->win != y->win)
+		return x->win < y->win ? -1 : 1;
+	if (x->atom != y->atom)
+		return x->atom < y->atom ? -1 : 1;
+	return 0;
+}
+
+/* what manage() and scan() read of each window */
+void
+prefetch(Window *wins, unsigned int n) {
+	Atom props[] = { atom[WindowType], atom[WMProto], atom[WMSyncCounter],
+		atom[MWMHints], XA_WM_NORMAL_HINTS, atom[WindowName], XA_WM_NAME,
+		XA_WM_CLASS, XA_WM_TRANSIENT_FOR, XA_WM_HINTS, atom[StrutPartial],
+		atom[WindowState], atom[WMState] };
+	xGetPropertyReq *req;
+	_XAsyncHandler async;
+	FetchState s;
+	unsigned int i, j, k;
+
+	unfetch();
+	if (!n)
+		return;
+	nfetched = n * LENGTH(props);
+	fetched = emallocz(nfetched * sizeof(Fetched));
+	for (i = 0, k = 0; i < n; i++)
+		for (j = 0; j < LENGTH(props); j++, k++) {
+			fetched[k].win = wins[i];
+			fetched[k].atom = props[j];
+		}
+	LockDisplay(dpy);
+	s.first = X_DPY_GET_REQUEST(dpy) + 1;
+	s.last = X_DPY_GET_REQUEST(dpy) + nfetched;
+	s.f = fetched;
+	async.next = dpy->async_handlers;
+	async.handler = fetchreply;
+	async.data = (XPointer) &s;
+	dpy->async_handlers = &async;
+	for (k = 0; k < nfetched; k++) {
+		GetReq(GetProperty, req);
+		req->window = fetched[k].win;
+		req->property = fetched[k].atom;
+		req->type = AnyPropertyType;
+		req->delete = False;
+		req->longOffset = 0;
+		req->longLength = FETCHLEN;
+	}
+	UnlockDisplay(dpy);
+	/* the one round trip: the replies all come in before this one's */
+	XSync(dpy, False);
+	LockDisplay(dpy);
+	DeqAsyncHandler(dpy, &async);
+	UnlockDisplay(dpy);
+	qsort(fetched, nfetched, sizeof(Fetched), fetchcmp);
+}
+
+Bool
+prefetched(Window win) {
+	Fetched key;
+
+	key.win = win;
+	key.atom = atom[WMState];
+	return bsearch(&key, fetched, nfetched, sizeof(Fetched), fetchcmp) != NULL;
+}
+
+void
+unfetch(void) {
+	unsigned int i;
+
+	for (i = 0; i < nfetched; i++)
+		free(fetched[i].data);
+	free(fetched);
+	fetched = NULL;
+	nfetched = 0;
+}
 
+/* XGetWindowProperty() of any type; the result is XFree()d */
+unsigned char *
+getprop(Window win, Atom prop, long len, Atom *type, int *format,
+    unsigned long *n) {
+	Fetched key, *f;
+	unsigned char *ret = NULL;
+	unsigned long extra, size;
+
+	key.win = win;
+	key.atom = prop;
+	if ((f = bsearch(&key, fetched, nfetched, sizeof(Fetched), fetchcmp))) {
+		*type = f->type;
+		*format = f->format;
+		*n = f->n;
+		if (!f->data)
+			return NULL;
+		size = f->format == 32 ? (f->n + 1) * sizeof(long) :
+		    f->n * (f->format / 8) + 1;
+		ret = emallocz(size);
+		memcpy(ret, f->data, size);
+		return ret;
 	}
+	if (XGetWindowProperty(dpy, win, prop, 0L, len, False, AnyPropertyType,
+	    type, format, n, &extra, &ret) != Success) {
+		*type = None;
+		*format = 0;
+		*n = 0;
+		return NULL;
+	}
+	return ret;
 }
 
 void *
 getatom(Window win, Atom atom, unsigned long *nitems) {
-	int format, status;
-	unsigned char *ret = NULL;
-	unsigned long extra;
 	Atom real;
+	int format;
 
-	status = XGetWindowProperty(dpy, win, atom, 0L, 64L, False, AnyPropertyType,
-			&real, &format, nitems, &extra, (unsigned char **)&ret);
-	if (status != Success) {
-		*nitems = 0;
-		return NULL;
-	}
+	return getprop(win, atom, 64L, &real, &format, nitems);
+}
 
+/* XGetTransientForHint() */
+Bool
+gettransient(Window win, Window *trans) {
+	Atom type;
+	int format;
+	unsigned long n;
+	long *data;
+	Bool ret;
+
+	data = (long *) getprop(win, XA_WM_TRANSIENT_FOR, 1L, &type, &format, &n);
+	if ((ret = type == XA_WINDOW && format == 32 && n))
+		*trans = data[0];
+	XFree(data);
 	return ret;
 }
 
+/* XGetWMNormalHints() */
+Bool
+getsizehints(Window win, XSizeHints *size) {
+	Atom type;
+	int format;
+	unsigned long n;
+	long *p;
+
+	memset(size, 0, sizeof(*size));
+	p = (long *) getprop(win, XA_WM_NORMAL_HINTS, 18L, &type, &format, &n);
+	/* pre-ICCCM ones have 15 and lack base size and gravity */
+	if (type != XA_WM_SIZE_HINTS || format != 32 || n < 15) {
+		XFree(p);
+		return False;
+	}
+	size->flags = p[0];
+	size->x = p[1];
+	size->y = p[2];
+	size->width = p[3];
+	size->height = p[4];
+	size->min_width = p[5];
+	size->min_height = p[6];
+	size->max_width = p[7];
+	size->max_height = p[8];
+	size->width_inc = p[9];
+	size->height_inc = p[10];
+	size->min_aspect.x = p[11];
+	size->min_aspect.y = p[12];
+	size->max_aspect.x = p[13];
+	size->max_aspect.y = p[14];
+	if (n >= 18) {
+		size->base_width = p[15];
+		size->base_height = p[16];
+		size->win_gravity = p[17];
+	} else
+		size->flags &= ~(PBaseSize | PWinGravity);
+	XFree(p);
+	return True;
+}
+
+/* XGetWMHints(), the fields we use */
+Bool
+getwmhints(Window win, XWMHints *wmh) {
+	Atom type;
+	int format;
+	unsigned long n;
+	long *p;
+
+	memset(wmh, 0, sizeof(*wmh));
+	p = (long *) getprop(win, XA_WM_HINTS, 9L, &type, &format, &n);
+	/* old clients leave out the window group */
+	if (type != XA_WM_HINTS || format != 32 || n < 8) {
+		XFree(p);
+		return False;
+	}
+	wmh->flags = p[0];
+	wmh->input = p[1];
+	wmh->initial_state = p[2];
+	XFree(p);
+	return True;
+}
+
+/* XGetClassHint(), the strings are XFree()d */
+Bool
+getclasshint(Window win, XClassHint *ch) {
+	Atom type;
+	int format;
+	unsigned long n;
+	char *p, *class;
+
+	ch->res_name = ch->res_class = NULL;
+	p = (char *) getprop(win, XA_WM_CLASS, FETCHLEN, &type, &format, &n);
+	if (!p || type != XA_STRING || format != 8) {
+		XFree(p);
+		return False;
+	}
+	/* "name\0class\0", and what getprop() returns is zero terminated */
+	class = strlen(p) < n ? p + strlen(p) + 1 : p + n;
+	ch->res_name = emallocz(strlen(p) + 1);
+	strcpy(ch->res_name, p);
+	ch->res_class = emallocz(strlen(class) + 1);
+	strcpy(ch->res_class, class);
+	XFree(p);
+	return True;
+}
+
 Bool
 checkatom(Window win, Atom bigatom, Atom smallatom) {
 	Atom *state;
@@ -320,6 +801,153 @@ checkatom(Window win, Atom bigatom, Atom smallatom) {
 	return ret;
 }
 
+int
+getprotocols(Window win) {
+	Atom *protos;
+	unsigned long i, n;
+	int ret = 0;
+
+	protos = (Atom*)getatom(win, atom[WMProto], &n);
+	for (i = 0; i < n; i++) {
+		if (protos[i] == atom[WMDelete])
+			ret |= ProtoDelete;
+		else if (protos[i] == atom[WMTakeFocus])
+			ret |= ProtoTakeFocus;
+		else if (protos[i] == atom[WMSyncRequest])
+			ret |= ProtoSyncRequest;
+	}
+	XFree(protos);
+	return ret;
+}
+
+XID
+getsynccounter(Window win) {
+	XID *counter, ret = None;
+	unsigned long n;
+
+	counter = (XID*)getatom(win, atom[WMSyncCounter], &n);
+	if (n)
+		ret = counter[0];
+	XFree(counter);
+	return ret;
+}
+
+void
+syncrequest(Client * c) {
+#ifdef XSYNC
+	XEvent ev;
+	XSyncAlarmAttributes attr;
+
+	if (!hassync || !c->cold->synccounter || !(c->cold->protocols & ProtoSyncRequest))
+		return;
+	ev.type = ClientMessage;
+	ev.xclient.window = c->win;
+	ev.xclient.message_type = atom[WMProto];
+	ev.xclient.format = 32;
+	ev.xclient.data.l[0] = atom[WMSyncRequest];
+	ev.xclient.data.l[1] = CurrentTime;
+	ev.xclient.data.l[2] = ++c->cold->syncvalue;
+	ev.xclient.data.l[3] = 0;
+	ev.xclient.data.l[4] = 0;
+	XSendEvent(dpy, c->win, False, NoEventMask, &ev);
+	/* the server tells us when the counter gets there */
+	XSyncIntToValue(&attr.trigger.wait_value, c->cold->syncvalue);
+	if (c->cold->syncalarm)
+		XSyncChangeAlarm(dpy, c->cold->syncalarm, XSyncCAValue, &attr);
+	else {
+		attr.trigger.counter = c->cold->synccounter;
+		attr.trigger.value_type = XSyncAbsolute;
+		attr.trigger.test_type = XSyncPositiveComparison;
+		attr.events = True;
+		c->cold->syncalarm = XSyncCreateAlarm(dpy, XSyncCACounter |
+		    XSyncCAValueType | XSyncCAValue | XSyncCATestType |
+		    XSyncCAEvents, &attr);
+		addwin(c->cold->syncalarm, c, ClientAlarm);
+	}
+	c->cold->syncdue = msnow() + SYNCTIMEOUT;
+	c->cold->syncwait = True;
+#endif
+}
+
+/* the counter changed or the client goes away */
+void
+syncfree(Client * c) {
+#ifdef XSYNC
+	if (c->cold->syncalarm) {
+		delwin(c->cold->syncalarm);
+		XSyncDestroyAlarm(dpy, c->cold->syncalarm);
+	}
+	c->cold->syncalarm = None;
+	c->cold->syncwait = False;
+#endif
+}
+
+/* returns the client whose alarm went off once it has drawn the last
+ * size asked for */
+Client *
+syncdone(XEvent * e) {
+#ifdef XSYNC
+	XSyncAlarmNotifyEvent *ev = (XSyncAlarmNotifyEvent *) e;
+	Client *c;
+
+	c = getclient(ev->alarm, ClientAlarm);
+	if (c && ev->state == XSyncAlarmDestroyed) {
+		/* the client destroyed its counter */
+		delwin(c->cold->syncalarm);
+		c->cold->syncalarm = c->cold->synccounter = None;
+		c->cold->syncwait = False;
+		return c;
+	}
+	if (!c || !c->cold->syncwait || XSyncValueHigh32(ev->counter_value)
+	    || XSyncValueLow32(ev->counter_value) < c->cold->syncvalue)
+		return NULL;
+	c->cold->syncwait = False;
+	return c;
+#else
+	return NULL;
+#endif
+}
+
+/* counters come from clients and may be gone or bogus */
+Bool
+syncerror(XErrorEvent * ee) {
+#ifdef XSYNC
+	return hassync && (ee->error_code == syncerrbase + XSyncBadCounter
+	    || ee->error_code == syncerrbase + XSyncBadAlarm);
+#else
+	return False;
+#endif
+}
+
+/* True while the client hasn't drawn the size we last sent it */
+Bool
+syncpending(Client * c) {
+	if (c->cold->syncwait && msnow() < c->cold->syncdue)
+		return True;
+	c->cold->syncwait = False;
+	return False;
+}
+
+int
+getwintype(Window win) {
+	Atom *types;
+	unsigned long i, n;
+	int ret = 0;
+
+	/* one round trip for every window type we care about */
+	types = (Atom*)getatom(win, atom[WindowType], &n);
+	for (i = 0; i < n; i++) {
+		if (types[i] == atom[WindowTypeDesk])
+			ret |= TypeDesk;
+		else if (types[i] == atom[WindowTypeDock])
+			ret |= TypeDock;
+		else if (types[i] == atom[WindowTypeDialog])
+			ret |= TypeDialog;
+	}
+	XFree(types);
+	return ret;
+}
+
 int
 getstruts(Client *c) {
 	unsigned long *state;
@@ -341,7 +969,7 @@ getstruts(Client *c) {
 }
 
 void (*updateatom[]) (Client *) = {
-	[ClientList] = ewmh_update_net_client_list,
+	[ClientListStacking] = ewmh_update_net_client_list_stacking,
 	[ActiveWindow] = ewmh_update_net_active_window,
 	[WindowDesk] = ewmh_update_net_window_desktop,
 	[NumberOfDesk] = ewmh_update_net_number_of_desktops,
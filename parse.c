@@ -195,7 +195,9 @@ static void
 parserule(const char *s, Rule *r) {
 	r->prop = emallocz(128);
 	r->tags = emallocz(64);
-	sscanf(s, "%s %s %d %d", r->prop, r->tags, &r->isfloating, &r->hastitle);
+	r->wireframe = -1;
+	sscanf(s, "%s %s %d %d %d", r->prop, r->tags, &r->isfloating,
+	    &r->hastitle, &r->wireframe);
 }
 
 static void
@@ -0,0 +1,135 @@
+/* Times the walk a layout makes over the clients of a monitor, with the
+ * cold part of every Client inline as it used to be and split off into
+ * chunks of its own as allocclient() does.  The caches are flushed before
+ * every walk, so what is measured is mostly the misses. */
+#define _POSIX_C_SOURCE 200809L
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/Xft/Xft.h>
+#include "../echinus.h"
+
+#define NCLIENTS	500
+#define CHUNK		64	/* CLIENTCHUNK in echinus.c */
+#define RUNS		200
+#define FLUSH		(32 << 20)
+
+typedef struct {
+	Client c;
+	ClientCold cold;
+} Inline;
+
+static char *flushbuf;
+static Tags seltags;
+static volatile long sink;	/* keeps the walks from being optimized out */
+
+static long
+nsnow(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void
+flush(void) {
+	unsigned int i;
+
+	for (i = 0; i < FLUSH; i += 64)
+		flushbuf[i]++;
+}
+
+/* what monlist() and a tiling layout read of each client */
+static long
+walk(Client *c) {
+	long sum = 0;
+
+	for (; c; c = c->next) {
+		if (!(c->tags->w[0] & seltags.w[0]) || c->isbastard)
+			continue;
+		if (c->isicon || c->isfloating)
+			continue;
+		sum += c->x + c->y + c->w + c->h + c->border + c->th;
+	}
+	return sum;
+}
+
+/* links the clients in a shuffled order, like a list after some churn */
+static Client *
+relink(Client **v, unsigned int *order) {
+	unsigned int i;
+
+	for (i = 0; i < NCLIENTS; i++) {
+		v[order[i]]->tags = &v[order[i]]->tagbits;
+		v[order[i]]->tagbits.w[0] = 1UL << (i % 4);
+		v[order[i]]->isfloating = i % 7 == 0;
+		v[order[i]]->next = i + 1 < NCLIENTS ? v[order[i + 1]] : NULL;
+	}
+	return v[order[0]];
+}
+
+static long
+bench(Client *head) {
+	long t, best = -1;
+	unsigned int i;
+
+	for (i = 0; i < RUNS; i++) {
+		flush();
+		t = nsnow();
+		sink += walk(head);
+		t = nsnow() - t;
+		if (best < 0 || t < best)
+			best = t;
+	}
+	return best;
+}
+
+int
+main(void) {
+	static Client *v[NCLIENTS];
+	unsigned int order[NCLIENTS], i, j, k;
+	Inline *in;
+	Client *chunk;
+	ClientCold *cold;
+	long tin, tsplit;
+
+	flushbuf = calloc(FLUSH, 1);
+	srand(1);
+	for (i = 0; i < NCLIENTS; i++)
+		order[i] = i;
+	for (i = NCLIENTS - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		k = order[i];
+		order[i] = order[j];
+		order[j] = k;
+	}
+	seltags.w[0] = 3;
+
+	in = calloc(NCLIENTS, sizeof(Inline));
+	for (i = 0; i < NCLIENTS; i++) {
+		in[i].c.cold = &in[i].cold;
+		v[i] = &in[i].c;
+	}
+	tin = bench(relink(v, order));
+
+	for (i = 0; i < NCLIENTS; i += CHUNK) {
+		chunk = calloc(CHUNK, sizeof(Client));
+		cold = calloc(CHUNK, sizeof(ClientCold));
+		for (j = 0; j < CHUNK && i + j < NCLIENTS; j++) {
+			chunk[j].cold = &cold[j];
+			v[i + j] = &chunk[j];
+		}
+	}
+	tsplit = bench(relink(v, order));
+
+	printf("%d clients, best of %d walks with cold caches\n", NCLIENTS, RUNS);
+	printf("cold part inline: %4zu bytes a client, %6ld ns a walk\n",
+	    sizeof(Inline), tin);
+	printf("cold part split:  %4zu bytes a client, %6ld ns a walk\n",
+	    sizeof(Client), tsplit);
+	return 0;
+}